@@ -0,0 +1,457 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * zenpower_bench - concurrent read benchmark for zenpower hwmon attributes
+ *
+ * Finds every hwmon device named "zenpower" and reads a mix of its
+ * attributes from N threads for a fixed time, as many polling agents would.
+ * Each thread keeps its own fds, since readers of one open file are
+ * serialized by kernfs, and walks the attribute list from its own offset.
+ *
+ * Reported per attribute: reads, reads per second, p50/p99/p999 latency of
+ * one pread(), and the share of reads that failed transiently: EAGAIN
+ * (no value yet, e.g. CCD ranking before the first sampler pass) or ENODATA
+ * (channel disabled through *_enable). Other failures are counted as
+ * errors.
+ *
+ * Usage:
+ *   zenpower_bench [--threads N] [--duration S] [--mix temps|all|rapl]
+ *                  [--sysfs-root DIR]
+ *
+ * Mixes:
+ *   temps   temp*_input
+ *   all     every readable attribute except uevent
+ *   rapl    power*_input labelled RAPL_P_*
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SYSFS_ROOT  "/sys/class/hwmon"
+
+/*
+ * Latency histogram: 16 linear sub-buckets per power of two of ns, so
+ * percentiles are within about 6%. 40 octaves reach past 15 minutes.
+ */
+#define HIST_SUB_BITS       4
+#define HIST_SUB            (1 << HIST_SUB_BITS)
+#define HIST_OCTAVES        40
+#define HIST_BUCKETS        (HIST_SUB * HIST_OCTAVES)
+
+enum mix {
+	MIX_TEMPS,
+	MIX_ALL,
+	MIX_RAPL,
+};
+
+static const char *const mix_names[] = { "temps", "all", "rapl" };
+
+/* One benchmarked attribute */
+struct attr {
+	char *path;
+	char *name;             /* hwmonN/attribute (label) */
+};
+
+/* Per-thread, per-attribute counters */
+struct stats {
+	uint64_t reads;
+	uint64_t transient;
+	uint64_t errors;
+	uint64_t hist[HIST_BUCKETS];
+};
+
+struct worker {
+	pthread_t thread;
+	unsigned int index;
+	int *fds;
+	struct stats *stats;
+};
+
+static struct attr *attrs;
+static size_t nr_attrs, nr_nodes;
+static unsigned int nr_threads = 4;
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+
+static void die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+/* Read a small sysfs file into @out, stripping the newline */
+static int read_file(const char *path, char *out, size_t size)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	n = read(fd, out, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	while (n > 0 && (out[n - 1] == '\n' || out[n - 1] == ' '))
+		n--;
+	out[n] = '\0';
+	return 0;
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+	size_t len = strlen(s), slen = strlen(suffix);
+
+	return len >= slen && !strcmp(s + len - slen, suffix);
+}
+
+/* <prefix><N>... */
+static int has_channel_prefix(const char *s, const char *prefix)
+{
+	size_t plen = strlen(prefix);
+
+	return !strncmp(s, prefix, plen) && s[plen] >= '0' && s[plen] <= '9';
+}
+
+/* tempN_input -> tempN_label contents, or "" */
+static void attr_label(const char *dir, const char *attr, char *label, size_t size)
+{
+	char path[PATH_MAX];
+	const char *us = strchr(attr, '_');
+
+	label[0] = '\0';
+	if (!us)
+		return;
+	if (snprintf(path, sizeof(path), "%s/%.*s_label", dir, (int)(us - attr),
+		     attr) >= (int)sizeof(path) || read_file(path, label, size))
+		label[0] = '\0';
+}
+
+static int want_attr(enum mix mix, const char *attr, const char *label)
+{
+	switch (mix) {
+	case MIX_TEMPS:
+		return has_channel_prefix(attr, "temp") && has_suffix(attr, "_input");
+	case MIX_RAPL:
+		return has_channel_prefix(attr, "power") && has_suffix(attr, "_input") &&
+		       !strncmp(label, "RAPL_P_", 7);
+	case MIX_ALL:
+		return strcmp(attr, "uevent") != 0;
+	}
+	return 0;
+}
+
+static void add_attr(const char *dir, const char *node, const char *attr,
+		     const char *label)
+{
+	char path[PATH_MAX], name[PATH_MAX];
+	struct stat st;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, attr) >= (int)sizeof(path))
+		return;
+	if (stat(path, &st) || !S_ISREG(st.st_mode) || !(st.st_mode & 0444))
+		return;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	close(fd);
+
+	attrs = realloc(attrs, (nr_attrs + 1) * sizeof(*attrs));
+	if (!attrs)
+		die("out of memory");
+
+	if (label[0])
+		snprintf(name, sizeof(name), "%s/%s (%s)", node, attr, label);
+	else
+		snprintf(name, sizeof(name), "%s/%s", node, attr);
+	attrs[nr_attrs].path = strdup(path);
+	attrs[nr_attrs].name = strdup(name);
+	nr_attrs++;
+}
+
+static void scan_node(const char *dir, const char *node, enum mix mix)
+{
+	char label[128];
+	struct dirent **ents;
+	int nr, i;
+
+	nr = scandir(dir, &ents, NULL, versionsort);
+	if (nr < 0)
+		return;
+
+	for (i = 0; i < nr; i++) {
+		const char *attr = ents[i]->d_name;
+
+		if (attr[0] != '.') {
+			attr_label(dir, attr, label, sizeof(label));
+			if (want_attr(mix, attr, label))
+				add_attr(dir, node, attr, label);
+		}
+		free(ents[i]);
+	}
+	free(ents);
+}
+
+static void scan_root(const char *root, enum mix mix)
+{
+	char dir[PATH_MAX], path[PATH_MAX], name[64];
+	struct dirent **ents;
+	int nr, i;
+
+	nr = scandir(root, &ents, NULL, versionsort);
+	if (nr < 0)
+		die("cannot read %s: %s", root, strerror(errno));
+
+	for (i = 0; i < nr; i++) {
+		if (ents[i]->d_name[0] == '.')
+			goto next;
+		/* A path that does not fit can not be opened either */
+		if (snprintf(dir, sizeof(dir), "%s/%s", root, ents[i]->d_name) >= (int)sizeof(dir) ||
+		    snprintf(path, sizeof(path), "%s/name", dir) >= (int)sizeof(path))
+			goto next;
+		if (read_file(path, name, sizeof(name)) || strcmp(name, "zenpower"))
+			goto next;
+		scan_node(dir, ents[i]->d_name, mix);
+		nr_nodes++;
+next:
+		free(ents[i]);
+	}
+	free(ents);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(uint64_t ns)
+{
+	unsigned int octave;
+
+	if (ns < HIST_SUB)
+		return ns;
+	octave = 63 - __builtin_clzll(ns) - HIST_SUB_BITS + 1;
+	if (octave >= HIST_OCTAVES)
+		return HIST_BUCKETS - 1;
+	return octave * HIST_SUB + ((ns >> (octave - 1)) & (HIST_SUB - 1));
+}
+
+/* Upper bound of a bucket in ns */
+static uint64_t hist_value(unsigned int bucket)
+{
+	unsigned int octave = bucket / HIST_SUB, sub = bucket % HIST_SUB;
+
+	if (!octave)
+		return sub;
+	return ((uint64_t)(HIST_SUB + sub + 1) << (octave - 1)) - 1;
+}
+
+static double hist_percentile(const uint64_t *hist, uint64_t total, double p)
+{
+	uint64_t rank = (uint64_t)(total * p), seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen > rank)
+			return hist_value(i) / 1e3;
+	}
+	return hist_value(HIST_BUCKETS - 1) / 1e3;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	size_t i = w->index * nr_attrs / nr_threads;
+	char buf[4096];
+	uint64_t t0, t1;
+	ssize_t n;
+
+	pthread_barrier_wait(&start_barrier);
+
+	while (!stop) {
+		struct stats *st = &w->stats[i];
+
+		t0 = now_ns();
+		n = pread(w->fds[i], buf, sizeof(buf), 0);
+		t1 = now_ns();
+
+		st->reads++;
+		st->hist[hist_bucket(t1 - t0)]++;
+		if (n < 0) {
+			if (errno == EAGAIN || errno == ENODATA)
+				st->transient++;
+			else
+				st->errors++;
+		}
+
+		if (++i == nr_attrs)
+			i = 0;
+	}
+
+	return NULL;
+}
+
+static void report(struct worker *workers, double secs, enum mix mix)
+{
+	uint64_t *hist, reads, transient, errors;
+	uint64_t total_reads = 0, total_transient = 0, total_errors = 0;
+	uint64_t *total_hist;
+	size_t a;
+	unsigned int t, b;
+
+	hist = calloc(HIST_BUCKETS, sizeof(*hist));
+	total_hist = calloc(HIST_BUCKETS, sizeof(*total_hist));
+	if (!hist || !total_hist)
+		die("out of memory");
+
+	printf("%zu nodes, %zu attributes, %u threads, mix %s, %.1f s\n",
+	       nr_nodes, nr_attrs, nr_threads, mix_names[mix], secs);
+	printf("%-40s %10s %10s %8s %8s %8s %10s %7s\n", "attribute", "reads",
+	       "reads/s", "p50_us", "p99_us", "p999_us", "transient%", "errors");
+
+	for (a = 0; a < nr_attrs; a++) {
+		memset(hist, 0, HIST_BUCKETS * sizeof(*hist));
+		reads = transient = errors = 0;
+		for (t = 0; t < nr_threads; t++) {
+			const struct stats *st = &workers[t].stats[a];
+
+			reads += st->reads;
+			transient += st->transient;
+			errors += st->errors;
+			for (b = 0; b < HIST_BUCKETS; b++)
+				hist[b] += st->hist[b];
+		}
+		for (b = 0; b < HIST_BUCKETS; b++)
+			total_hist[b] += hist[b];
+		total_reads += reads;
+		total_transient += transient;
+		total_errors += errors;
+
+		if (!reads)
+			continue;
+		printf("%-40s %10llu %10.0f %8.1f %8.1f %8.1f %10.3f %7llu\n",
+		       attrs[a].name, (unsigned long long)reads, reads / secs,
+		       hist_percentile(hist, reads, 0.50),
+		       hist_percentile(hist, reads, 0.99),
+		       hist_percentile(hist, reads, 0.999),
+		       100.0 * transient / reads, (unsigned long long)errors);
+	}
+
+	if (total_reads)
+		printf("%-40s %10llu %10.0f %8.1f %8.1f %8.1f %10.3f %7llu\n",
+		       "total", (unsigned long long)total_reads, total_reads / secs,
+		       hist_percentile(total_hist, total_reads, 0.50),
+		       hist_percentile(total_hist, total_reads, 0.99),
+		       hist_percentile(total_hist, total_reads, 0.999),
+		       100.0 * total_transient / total_reads,
+		       (unsigned long long)total_errors);
+
+	free(hist);
+	free(total_hist);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: zenpower_bench [--threads N] [--duration S] [--mix temps|all|rapl]\n"
+		"                      [--sysfs-root DIR]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *root = DEFAULT_SYSFS_ROOT;
+	enum mix mix = MIX_ALL;
+	double duration = 5, secs;
+	struct worker *workers;
+	struct timespec ts;
+	uint64_t t0;
+	unsigned int t;
+	size_t a;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			nr_threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--duration") && i + 1 < argc) {
+			duration = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "--sysfs-root") && i + 1 < argc) {
+			root = argv[++i];
+		} else if (!strcmp(argv[i], "--mix") && i + 1 < argc) {
+			const char *m = argv[++i];
+
+			for (mix = 0; mix <= MIX_RAPL && strcmp(m, mix_names[mix]); mix++)
+				;
+			if (mix > MIX_RAPL)
+				usage();
+		} else {
+			usage();
+		}
+	}
+	if (!nr_threads || duration <= 0)
+		usage();
+
+	scan_root(root, mix);
+	if (!nr_nodes)
+		die("no zenpower hwmon device under %s", root);
+	if (!nr_attrs)
+		die("no attribute matches mix %s", mix_names[mix]);
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers)
+		die("out of memory");
+	for (t = 0; t < nr_threads; t++) {
+		workers[t].index = t;
+		workers[t].fds = calloc(nr_attrs, sizeof(int));
+		workers[t].stats = calloc(nr_attrs, sizeof(struct stats));
+		if (!workers[t].fds || !workers[t].stats)
+			die("out of memory");
+		for (a = 0; a < nr_attrs; a++) {
+			workers[t].fds[a] = open(attrs[a].path, O_RDONLY | O_CLOEXEC);
+			if (workers[t].fds[a] < 0)
+				die("cannot open %s: %s", attrs[a].path, strerror(errno));
+		}
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+	for (t = 0; t < nr_threads; t++) {
+		if (pthread_create(&workers[t].thread, NULL, worker_fn, &workers[t]))
+			die("cannot start thread %u", t);
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	t0 = now_ns();
+	ts.tv_sec = (time_t)duration;
+	ts.tv_nsec = (long)((duration - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+	stop = 1;
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(workers[t].thread, NULL);
+	secs = (now_ns() - t0) / 1e9;
+
+	report(workers, secs, mix);
+
+	return 0;
+}
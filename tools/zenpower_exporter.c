@@ -0,0 +1,523 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * zenpower_exporter - Prometheus exporter for zenpower hwmon devices
+ *
+ * Finds every hwmon device named "zenpower" once at startup, reads the
+ * labels once, and keeps one fd open per *_input attribute (plus the
+ * throttle counters). A scrape is then one pread() per attribute for all
+ * nodes, formatted as Prometheus text and served over HTTP on a local TCP
+ * or Unix socket.
+ *
+ * Usage:
+ *   zenpower_exporter [--listen tcp:ADDR:PORT | --listen unix:PATH]
+ *   zenpower_exporter --once          print one scrape and exit
+ *   zenpower_exporter --bench N       scrape N times and report the cost
+ *   --sysfs-root DIR                  hwmon class directory (for testing)
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_LISTEN      "tcp:127.0.0.1:9742"
+#define DEFAULT_SYSFS_ROOT  "/sys/class/hwmon"
+
+/* One exported attribute */
+struct metric {
+	int fd;
+	size_t kind;            /* index in kinds[] */
+	size_t seq;             /* discovery order within the kind */
+	const char *name;       /* Prometheus metric name */
+	int decimals;           /* sysfs value / 10^decimals = base unit */
+	char *labels;           /* preformatted {node=...,...} */
+	char *path;             /* for --bench reopen mode */
+};
+
+struct metric_kind {
+	const char *prefix;     /* sysfs attribute prefix */
+	const char *name;
+	const char *help;
+	const char *type;
+	int decimals;
+};
+
+static const struct metric_kind kinds[] = {
+	{ "temp", "zenpower_temperature_celsius", "Temperature", "gauge", 3 },
+	{ "in", "zenpower_voltage_volts", "Voltage", "gauge", 3 },
+	{ "curr", "zenpower_current_amperes", "Current", "gauge", 3 },
+	{ "power", "zenpower_power_watts", "Power", "gauge", 6 },
+	{ "energy", "zenpower_energy_joules_total", "Energy", "counter", 6 },
+	/* throttle_<source><prefix> */
+	{ "_entries", "zenpower_throttle_entries_total",
+	  "Entries into a near-limit band", "counter", 0 },
+	{ "_time_ms", "zenpower_throttle_seconds_total",
+	  "Time spent in a near-limit band", "counter", 3 },
+};
+
+#define NR_KINDS            (sizeof(kinds) / sizeof(kinds[0]))
+#define NR_HWMON_KINDS      5
+
+static struct metric *metrics;
+static size_t nr_metrics, nr_nodes;
+
+struct buf {
+	char *data;
+	size_t len, size;
+};
+
+static void die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static void buf_reserve(struct buf *b, size_t n)
+{
+	if (b->len + n <= b->size)
+		return;
+	while (b->len + n > b->size)
+		b->size = b->size ? b->size * 2 : 16384;
+	b->data = realloc(b->data, b->size);
+	if (!b->data)
+		die("out of memory");
+}
+
+static void buf_printf(struct buf *b, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->data + b->len, b->size - b->len, fmt, ap);
+		va_end(ap);
+		if (n >= 0 && b->len + n < b->size) {
+			b->len += n;
+			return;
+		}
+		buf_reserve(b, n + 1);
+	}
+}
+
+/* Read a small sysfs file into @out, stripping the newline */
+static int read_file(const char *path, char *out, size_t size)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	n = read(fd, out, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	while (n > 0 && (out[n - 1] == '\n' || out[n - 1] == ' '))
+		n--;
+	out[n] = '\0';
+	return 0;
+}
+
+static void add_metric(size_t kind, const char *dir,
+		       const char *attr, const char *node, const char *device,
+		       const char *label)
+{
+	/* node, device and label are file names, at most NAME_MAX each */
+	char path[PATH_MAX], labels[3 * NAME_MAX + 32];
+	struct metric *m;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, attr) >= (int)sizeof(path))
+		return;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	metrics = realloc(metrics, (nr_metrics + 1) * sizeof(*metrics));
+	if (!metrics)
+		die("out of memory");
+
+	snprintf(labels, sizeof(labels), "{node=\"%s\",device=\"%s\",label=\"%s\"}",
+		 node, device, label);
+
+	m = &metrics[nr_metrics];
+	m->fd = fd;
+	m->kind = kind;
+	m->seq = nr_metrics++;
+	m->name = kinds[kind].name;
+	m->decimals = kinds[kind].decimals;
+	m->labels = strdup(labels);
+	m->path = strdup(path);
+}
+
+/* tempN_input -> tempN_label contents, or the attribute stem */
+static void attr_label(const char *dir, const char *attr, char *label, size_t size)
+{
+	char path[PATH_MAX];
+	size_t stem = strlen(attr) - strlen("_input");
+
+	if (snprintf(path, sizeof(path), "%s/%.*s_label", dir, (int)stem,
+		     attr) >= (int)sizeof(path) || read_file(path, label, size))
+		snprintf(label, size, "%.*s", (int)stem, attr);
+}
+
+static void scan_node(const char *dir, const char *node)
+{
+	char target[PATH_MAX], link[PATH_MAX], label[NAME_MAX + 1];
+	const char *device = node;
+	struct dirent **ents;
+	ssize_t n;
+	size_t i;
+	int nr, j;
+
+	/* PCI address of the node, from the device symlink */
+	n = -1;
+	if (snprintf(link, sizeof(link), "%s/device", dir) < (int)sizeof(link))
+		n = readlink(link, target, sizeof(target) - 1);
+	if (n > 0) {
+		target[n] = '\0';
+		device = strrchr(target, '/') ? strrchr(target, '/') + 1 : target;
+	}
+
+	/* Sorted, so the output is stable across scrapes */
+	nr = scandir(dir, &ents, NULL, versionsort);
+	if (nr < 0)
+		return;
+
+	for (j = 0; j < nr; j++) {
+		const char *attr = ents[j]->d_name;
+		size_t len = strlen(attr);
+
+		/* throttle_<source>_entries, throttle_<source>_time_ms */
+		if (!strncmp(attr, "throttle_", 9)) {
+			for (i = NR_HWMON_KINDS; i < NR_KINDS; i++) {
+				size_t slen = strlen(kinds[i].prefix);
+
+				if (len <= 9 + slen || strcmp(attr + len - slen, kinds[i].prefix))
+					continue;
+				snprintf(label, sizeof(label), "%.*s",
+					 (int)(len - slen - 9), attr + 9);
+				add_metric(i, dir, attr, node, device, label);
+			}
+			continue;
+		}
+
+		/* <type><N>_input */
+		for (i = 0; i < NR_HWMON_KINDS; i++) {
+			size_t plen = strlen(kinds[i].prefix);
+
+			if (strncmp(attr, kinds[i].prefix, plen) || len < plen + 7 ||
+			    attr[plen] < '0' || attr[plen] > '9' ||
+			    strcmp(attr + len - 6, "_input"))
+				continue;
+			attr_label(dir, attr, label, sizeof(label));
+			add_metric(i, dir, attr, node, device, label);
+			break;
+		}
+	}
+
+	for (j = 0; j < nr; j++)
+		free(ents[j]);
+	free(ents);
+}
+
+static void scan_root(const char *root)
+{
+	char dir[PATH_MAX], path[PATH_MAX], name[64];
+	struct dirent **ents;
+	int nr, i;
+
+	nr = scandir(root, &ents, NULL, versionsort);
+	if (nr < 0)
+		die("cannot read %s: %s", root, strerror(errno));
+
+	for (i = 0; i < nr; i++) {
+		if (ents[i]->d_name[0] == '.')
+			goto next;
+		/* A path that does not fit can not be opened either */
+		if (snprintf(dir, sizeof(dir), "%s/%s", root, ents[i]->d_name) >= (int)sizeof(dir) ||
+		    snprintf(path, sizeof(path), "%s/name", dir) >= (int)sizeof(path))
+			goto next;
+		if (read_file(path, name, sizeof(name)) || strcmp(name, "zenpower"))
+			goto next;
+		scan_node(dir, ents[i]->d_name);
+		nr_nodes++;
+next:
+		free(ents[i]);
+	}
+	free(ents);
+}
+
+/* Integer sysfs value as a decimal in the base unit */
+static void put_value(struct buf *b, const char *raw, int decimals)
+{
+	static const long long pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+	long long v = strtoll(raw, NULL, 10);
+	long long div = pow10[decimals];
+	const char *sign = v < 0 ? "-" : "";
+
+	if (v < 0)
+		v = -v;
+	if (decimals)
+		buf_printf(b, "%s%lld.%0*lld\n", sign, v / div, decimals, v % div);
+	else
+		buf_printf(b, "%s%lld\n", sign, v);
+}
+
+/* One scrape of every node. @reopen opens each file per read, for comparison. */
+static void scrape(struct buf *b, int reopen)
+{
+	size_t last = NR_KINDS;
+	char raw[64];
+	size_t i;
+	ssize_t n;
+
+	b->len = 0;
+	for (i = 0; i < nr_metrics; i++) {
+		struct metric *m = &metrics[i];
+		int fd = m->fd;
+
+		if (reopen) {
+			fd = open(m->path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				continue;
+		}
+		n = pread(fd, raw, sizeof(raw) - 1, 0);
+		if (reopen)
+			close(fd);
+		/* -EAGAIN/-ENODATA and friends: no sample this time */
+		if (n <= 0)
+			continue;
+		raw[n] = '\0';
+
+		if (m->kind != last) {
+			buf_printf(b, "# HELP %s %s\n# TYPE %s %s\n", m->name,
+				   kinds[m->kind].help, m->name, kinds[m->kind].type);
+			last = m->kind;
+		}
+		buf_printf(b, "%s%s ", m->name, m->labels);
+		put_value(b, raw, m->decimals);
+	}
+}
+
+static int compare_metrics(const void *a, const void *b)
+{
+	const struct metric *x = a, *y = b;
+
+	/* One block per metric family, nodes in discovery order */
+	if (x->kind != y->kind)
+		return x->kind < y->kind ? -1 : 1;
+	return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static double ts_us(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e6 + (b->tv_nsec - a->tv_nsec) / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void bench_mode(struct buf *b, long count, int reopen)
+{
+	struct timespec w0, w1, c0, c1;
+	double *lat, cpu_us;
+	long i;
+
+	lat = calloc(count, sizeof(*lat));
+	if (!lat)
+		die("out of memory");
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c0);
+	for (i = 0; i < count; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &w0);
+		scrape(b, reopen);
+		clock_gettime(CLOCK_MONOTONIC, &w1);
+		lat[i] = ts_us(&w0, &w1);
+	}
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c1);
+	cpu_us = ts_us(&c0, &c1) / count;
+
+	qsort(lat, count, sizeof(*lat), compare_double);
+	printf("%-12s %8.1f %8.1f %8.1f %8.1f %10.1f %8zu\n",
+	       reopen ? "open+read" : "pread", lat[count / 2],
+	       lat[count * 99 / 100], lat[count - 1],
+	       cpu_us, 1e6 / (lat[count / 2] > 0 ? lat[count / 2] : 1), b->len);
+	free(lat);
+}
+
+static void bench(long count)
+{
+	struct buf b = { 0 };
+
+	printf("%zu nodes, %zu attributes, %ld scrapes\n", nr_nodes, nr_metrics, count);
+	printf("%-12s %8s %8s %8s %8s %10s %8s\n", "mode", "p50_us", "p99_us",
+	       "max_us", "cpu_us", "scrapes/s", "bytes");
+	bench_mode(&b, count, 0);
+	bench_mode(&b, count, 1);
+	free(b.data);
+}
+
+static int listen_socket(const char *spec)
+{
+	int fd, one = 1;
+
+	if (!strncmp(spec, "unix:", 5)) {
+		struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+		if (strlen(spec + 5) >= sizeof(sun.sun_path))
+			die("socket path too long");
+		strcpy(sun.sun_path, spec + 5);
+		unlink(sun.sun_path);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)))
+			die("cannot bind %s: %s", spec, strerror(errno));
+	} else if (!strncmp(spec, "tcp:", 4)) {
+		struct sockaddr_in sin = { .sin_family = AF_INET };
+		char host[64];
+		const char *colon = strrchr(spec + 4, ':');
+
+		if (!colon || (size_t)(colon - spec - 4) >= sizeof(host))
+			die("bad listen address %s", spec);
+		snprintf(host, sizeof(host), "%.*s", (int)(colon - spec - 4), spec + 4);
+		sin.sin_port = htons(atoi(colon + 1));
+		if (inet_pton(AF_INET, host, &sin.sin_addr) != 1)
+			die("bad listen address %s", spec);
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			die("socket: %s", strerror(errno));
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)))
+			die("cannot bind %s: %s", spec, strerror(errno));
+	} else {
+		die("listen address must be tcp:ADDR:PORT or unix:PATH");
+	}
+
+	if (listen(fd, 16))
+		die("listen: %s", strerror(errno));
+
+	return fd;
+}
+
+static void write_all(int fd, const char *p, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return;
+		p += n;
+		len -= n;
+	}
+}
+
+/* Serve every request with a fresh scrape; one connection at a time */
+static void serve(const char *spec)
+{
+	struct buf b = { 0 };
+	char req[1024], hdr[256];
+	int lfd, cfd, n;
+
+	lfd = listen_socket(spec);
+	signal(SIGPIPE, SIG_IGN);
+	fprintf(stderr, "zenpower_exporter: %zu nodes, %zu attributes, listening on %s\n",
+		nr_nodes, nr_metrics, spec);
+
+	for (;;) {
+		struct pollfd pfd;
+
+		cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+		if (cfd < 0)
+			continue;
+
+		/* The request itself is not parsed, any path returns the metrics */
+		pfd.fd = cfd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 1000) == 1 && read(cfd, req, sizeof(req)) < 0)
+			fprintf(stderr, "zenpower_exporter: read: %s\n", strerror(errno));
+
+		scrape(&b, 0);
+		n = snprintf(hdr, sizeof(hdr),
+			     "HTTP/1.0 200 OK\r\n"
+			     "Content-Type: text/plain; version=0.0.4\r\n"
+			     "Content-Length: %zu\r\n"
+			     "Connection: close\r\n\r\n", b.len);
+		write_all(cfd, hdr, n);
+		write_all(cfd, b.data, b.len);
+		close(cfd);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: zenpower_exporter [--listen tcp:ADDR:PORT|unix:PATH] [--once]\n"
+		"                         [--bench N] [--sysfs-root DIR]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *listen_spec = DEFAULT_LISTEN, *root = DEFAULT_SYSFS_ROOT;
+	long bench_count = 0;
+	int once = 0, i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--listen") && i + 1 < argc)
+			listen_spec = argv[++i];
+		else if (!strcmp(argv[i], "--sysfs-root") && i + 1 < argc)
+			root = argv[++i];
+		else if (!strcmp(argv[i], "--bench") && i + 1 < argc)
+			bench_count = atol(argv[++i]);
+		else if (!strcmp(argv[i], "--once"))
+			once = 1;
+		else
+			usage();
+	}
+
+	scan_root(root);
+	if (!nr_nodes)
+		die("no zenpower hwmon device under %s", root);
+	qsort(metrics, nr_metrics, sizeof(*metrics), compare_metrics);
+
+	if (bench_count > 0) {
+		bench(bench_count);
+	} else if (once) {
+		struct buf b = { 0 };
+
+		scrape(&b, 0);
+		fwrite(b.data, 1, b.len, stdout);
+		free(b.data);
+	} else {
+		serve(listen_spec);
+	}
+
+	return 0;
+}
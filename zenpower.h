@@ -10,62 +10,421 @@
 #include <linux/pci.h>
 #include <linux/hwmon.h>
 #include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+
+#ifndef HWMON_CHANNEL_INFO
+#define HWMON_CHANNEL_INFO(stype, ...)	\
+	(&(struct hwmon_channel_info) {		\
+		.type = hwmon_##stype,			\
+		.config = (u32 []) {			\
+			__VA_ARGS__, 0				\
+		}								\
+	})
+#endif
 
 /* CPU model configuration flags */
-#define ZEN_CFG_ZEN2_CALC    BIT(0)  /* Use Zen2+ current formula */
 #define ZEN_CFG_MULTINODE    BIT(1)  /* Multinode (TR/EPYC) configuration */
-#define ZEN_CFG_RAPL         BIT(2)  /* Use RAPL for power monitoring */
-#define ZEN_CFG_IS_ZEN5      BIT(3)  /* Zen 5 architecture */
-#define ZEN_CFG_NO_RAPL_CORE BIT(4)  /* RAPL Core power unavailable/meaningless */
+
+/* Tctl limit reported as hwmon temp max and used for throttle detection */
+#define ZEN_TCTL_MAX         95000   /* millidegrees */
+
+/* Metrics decoded from the SMU PM table */
+enum zenpower_pmt_metric {
+	ZEN_PMT_PPT_LIMIT,
+	ZEN_PMT_PPT_VALUE,
+	ZEN_PMT_TDC_LIMIT,
+	ZEN_PMT_TDC_VALUE,
+	ZEN_PMT_EDC_LIMIT,
+	ZEN_PMT_EDC_VALUE,
+	ZEN_PMT_THM_LIMIT,
+	ZEN_PMT_THM_VALUE,
+	ZEN_PMT_FCLK,
+	ZEN_PMT_UCLK,
+	ZEN_PMT_MCLK,
+	ZEN_PMT_FMAX,
+	ZEN_PMT_NR_METRICS
+};
+
+/* Location of one float metric in the PM table */
+struct zenpower_pmt_field {
+	u16 offset;
+	bool valid;
+};
+
+/* SMU mailbox and PM table layout for one model/table version */
+struct zenpower_pmtable_layout {
+	u32 mb_cmd;             /* SMU mailbox command register (SMN) */
+	u32 mb_rsp;             /* SMU mailbox response register (SMN) */
+	u32 mb_args;            /* SMU mailbox first argument register (SMN) */
+	u8 cmd_transfer;        /* TransferTableToDram message */
+	u8 cmd_get_base;        /* GetDramBaseAddress message */
+	u8 cmd_get_version;     /* GetPMTableVersion message */
+	u32 version;            /* PM table version this layout decodes */
+	u32 size;               /* PM table size in bytes */
+	struct zenpower_pmt_field field[ZEN_PMT_NR_METRICS];
+	u16 core_power;         /* Per-core power array offset (0 if absent) */
+	u16 core_freq;          /* Per-core clock array offset (0 if absent) */
+	u8 max_cores;           /* Entries in the per-core arrays */
+	const char *name;       /* Layout name for logging */
+};
+
+struct zenpower_data;
+struct zenpower_channel;
+
+/* hwmon channel read handler, bound to the channel at probe */
+typedef int (*zenpower_read_fn)(struct zenpower_data *data,
+				const struct zenpower_channel *ch, u32 attr, long *val);
+
+/* hwmon channel write handler, for the attributes in zenpower_channel.wattrs */
+typedef int (*zenpower_write_fn)(struct zenpower_data *data,
+				 const struct zenpower_channel *ch, u32 attr, long val);
+
+/* hwmon sensor types and channels indexing zenpower_data.chan */
+#define ZEN_NR_TYPES         (hwmon_energy + 1)
+#define ZEN_NR_CHANNELS      10      /* Tdie, Tctl, Tccd1-8 */
+
+/* A bound hwmon channel: its handler and the handler's argument */
+struct zenpower_channel {
+	zenpower_read_fn read;  /* NULL when the channel is hidden */
+	u32 attrs;              /* exposed attributes, HWMON_*_ bits */
+	zenpower_write_fn write;
+	u32 wattrs;             /* writable subset of attrs */
+	u32 addr;               /* SMN register (SVI2 plane, CCD temperature) */
+	u8 index;               /* plane or PM table value metric */
+	u8 label;               /* column of the label table, the channel by default */
+	u8 limit;               /* PM table limit metric */
+	bool priv;              /* root-only, see zenpower_is_visible() */
+};
+
+/*
+ * Telemetry backend of a model: read handlers for the model-specific
+ * channels. A NULL handler leaves those channels hidden.
+ */
+struct zenpower_backend_ops {
+	const char *name;
+	zenpower_read_fn temp;  /* Tccd */
+	zenpower_read_fn in;    /* plane voltage */
+	zenpower_read_fn curr;  /* plane current */
+	zenpower_read_fn power; /* plane power */
+	zenpower_read_fn energy; /* plane energy, integrated by the sampler */
+	u32 svi2_current[2];    /* uA per IDD step - [0]=core, [1]=SoC */
+};
 
 /* CPU model configuration entry */
 struct zenpower_model_config {
 	u8 family;              /* x86 family (0x17, 0x19, 0x1a) */
 	u8 model;               /* x86 model (0x01, 0x31, 0x70, etc.) */
+	const struct zenpower_backend_ops *backend; /* Telemetry backend */
 	u32 svi_core_addr;      /* SVI2 core telemetry address */
 	u32 svi_soc_addr;       /* SVI2 SoC telemetry address */
 	u32 ccd_temp_base;      /* Base address for CCD temperatures */
 	u8 num_ccds;            /* Number of CCDs to check */
 	u16 flags;              /* Configuration flags (ZEN_CFG_*) */
+	const struct zenpower_pmtable_layout *pmtable; /* SMU PM table, if known */
 	const char *name;       /* Model name for debugging */
 };
 
+struct zenpower_pmtable;
+struct zenpower_rapl_hf;
+struct zenpower_hist;
+struct zenpower_ccd_map;
+struct zenpower_history;
+struct zenpower_em;
+struct zenpower_pcap;
+struct zenpower_tick;
+
+/* One sampler pass, handed to every sampler consumer */
+struct zenpower_sample {
+	ktime_t time;
+	bool has_temps;
+	bool has_tctl;          /* Tctl read; not when Tdie and Tctl are disabled */
+	int tctl;               /* millidegrees */
+	u8 tccd_valid;          /* CCDs read in this pass */
+	int tccd[8];            /* millidegrees, 0 when the CCD was not read */
+	int tccd_max;
+	bool has_svi2;
+	u8 svi2_valid;          /* planes read in this pass, see zenpower_plane_on() */
+	u32 svi2_plane[2];      /* raw SVI2 telemetry - [0]=core, [1]=SoC */
+	u32 svi2_power[2];      /* uW - [0]=core, [1]=SoC */
+	u64 rapl_energy;        /* accumulated package uJ */
+	bool has_rapl_power;
+	u64 rapl_power;         /* package uW since the previous pass */
+};
+
+/* Per-CPU core energy and APERF/MPERF, read for the Energy Model feed */
+struct zenpower_core_sample {
+	u64 energy;             /* raw RAPL core energy counter */
+	u64 aperf;
+	u64 mperf;
+	int err;
+};
+
+/* Throttle detector sources */
+enum zenpower_throttle_source {
+	ZEN_THROTTLE_TCTL,
+	ZEN_THROTTLE_TCCD,
+	ZEN_THROTTLE_POWER,
+	ZEN_THROTTLE_NR
+};
+
+/* Near-limit residency of one throttle source */
+struct zenpower_throttle_state {
+	u64 entries;
+	u64 exits;
+	u64 time_ns;            /* completed near-limit time */
+	ktime_t since;          /* start of the current near-limit period */
+	long limit;             /* last limit compared against */
+	bool active;
+};
+
 /* Shared data structure */
 struct zenpower_data {
 	struct pci_dev *pdev;
 	void (*read_amdsmn_addr)(struct pci_dev *pdev, u16 node_id, u32 address, u32 *regval);
+	void (*write_amdsmn_addr)(struct pci_dev *pdev, u16 node_id, u32 address, u32 regval);
 	u32 svi_core_addr;
 	u32 svi_soc_addr;
 	u16 node_id;
 	u8 cpu_id;
 	u8 nodes_per_cpu;
+	int numa_node;          /* NUMA node owning this DF node */
 	int temp_offset;
-	bool zen2;
-	bool zen5;
 	bool kernel_smn_support;
-	bool amps_visible;
 	bool ccd_visible[8];
-	bool no_rapl_core;
-
-	/* RAPL power tracking (zen5 only) - [0]=package, [1]=core */
-	u64 rapl_prev_energy[2];
-	ktime_t rapl_prev_time[2];
-	bool rapl_available[2];
-	u32 rapl_energy_unit;
-	bool rapl_initialized;
+	u32 ccd_addr[8];        /* CCD temperature registers */
+
+	/* Backend bound at probe, and the hwmon channels bound to it */
+	const struct zenpower_backend_ops *backend;
+	struct zenpower_channel chan[ZEN_NR_TYPES][ZEN_NR_CHANNELS];
+	unsigned long chan_off[ZEN_NR_TYPES]; /* disabled through *_enable, or unbound */
+
+	/* RAPL package power tracking, under rapl_lock */
+	u64 rapl_prev_acc;          /* accumulator at the start of the power window */
+	ktime_t rapl_prev_time;
+	u64 rapl_power;             /* uW over the last completed window */
+	u8 rapl_esu;                /* energy status unit: 1/2^ESU J per count */
+	bool rapl_initialized;      /* package energy counter available */
+	bool rapl_core_energy;      /* per-core energy MSR available (Energy Model feed) */
+	int rapl_cpu;               /* online CPU of the owning package, -1 if none */
+	struct hlist_node rapl_cpuhp;
+
+	/* RAPL 64-bit energy accumulation (32-bit hardware counters) */
+	struct mutex rapl_lock;
+	u64 rapl_energy_acc;
+	u32 rapl_energy_last;
+
+	/* RAPL high-frequency sampler, NULL when disabled */
+	struct zenpower_rapl_hf *rapl_hf;
+
+	/* SMU PM table backend state, NULL when unavailable */
+	struct zenpower_pmtable *pmt;
+
+	/* Background sampler, serviced by the tick of the package */
+	struct zenpower_tick *tick;     /* NULL when not sampling */
+	struct list_head sample_node;
+	unsigned int sample_interval_ms;
+	bool sample_fast;           /* sample_interval_ms set, not housekeeping only */
+	u64 samples;
+	spinlock_t sample_lock;     /* protects sampler-maintained state */
+	struct zenpower_sample last_sample;
+
+	/* Open /dev/zenpower energy windows (sampler), under sample_lock */
+	struct list_head windows;
+
+	/* Throttle detector (sampler) */
+	bool throttle_enabled;
+	bool throttle_power;        /* a package power limit is known */
+	struct zenpower_throttle_state throttle[ZEN_THROTTLE_NR];
+
+	/* SVI2 energy integration (sampler) - [0]=core, [1]=SoC */
+	bool svi2_energy;
+	u64 svi2_energy_nj[2];
+	u32 svi2_prev_power[2];
+	ktime_t svi2_prev_time[2];  /* 0 while the plane is not sampled */
+
+	/* Residency histograms (sampler), under sample_lock; NULL when disabled */
+	struct zenpower_hist *hist;
+
+	/* CCD to CPU map and temperature ranking (sampler), NULL when unavailable */
+	struct zenpower_ccd_map *ccd_map;
+
+	/* Tiered history (sampler), under sample_lock; NULL when disabled */
+	struct zenpower_history *history;
+
+	/* Energy Model feed (sampler), NULL when disabled */
+	struct zenpower_em *em;
+
+	/* Package power cap controller (sampler), NULL when disabled */
+	struct zenpower_pcap *pcap;
+
+	/* Registered hwmon device, for sysfs_notify() from the sampler */
+	struct device *hwmon_dev;
+
+	/* Per-node debugfs directory, NULL without debugfs */
+	struct dentry *debugfs;
+
+	/* Entry on the /dev/zenpower device list, and the device's id there */
+	struct list_head list;
+	int dev_id;
 };
 
+/* Whether a channel is bound and enabled; others are left out of every sweep */
+static inline bool zenpower_chan_on(const struct zenpower_data *data,
+				    enum hwmon_sensor_types type, int channel)
+{
+	return !test_bit(channel, &data->chan_off[type]);
+}
+
+/* Whether SVI2 plane @i (0=core, 1=SoC) feeds an enabled channel */
+static inline bool zenpower_plane_on(const struct zenpower_data *data, int i)
+{
+	return zenpower_chan_on(data, hwmon_in, i + 1) ||
+	       zenpower_chan_on(data, hwmon_curr, i) ||
+	       zenpower_chan_on(data, hwmon_power, i) ||
+	       zenpower_chan_on(data, hwmon_energy, i);
+}
+
+/* Core helpers */
+void *zenpower_devm_kzalloc(struct zenpower_data *data, struct device *dev,
+			    size_t size);
+
+/* Sampler functions */
+int zenpower_sampler_init(struct zenpower_data *data, struct device *dev);
+int zenpower_sampler_cpu(struct zenpower_data *data);
+void zenpower_sampler_sync(struct zenpower_data *data);
+void zenpower_sampler_exit(void);
+
 /* SVI2 backend functions */
+extern const struct zenpower_backend_ops zenpower_svi2_zen1_ops;
+extern const struct zenpower_backend_ops zenpower_svi2_zen2_ops;
+
 u32 zenpower_svi2_plane_to_vcc(u32 plane);
-u32 zenpower_svi2_get_core_current(u32 plane, bool zen2);
-u32 zenpower_svi2_get_soc_current(u32 plane, bool zen2);
+u32 zenpower_svi2_get_current(const struct zenpower_data *data, u32 plane, int i);
+u32 zenpower_svi2_get_power(const struct zenpower_data *data, u32 plane, int i);
+void zenpower_svi2_sample(struct zenpower_data *data, struct zenpower_sample *s);
+u64 zenpower_svi2_get_energy(struct zenpower_data *data, int channel);
 
 /* RAPL backend functions */
+int zenpower_rapl_cpuhp_init(void);
+void zenpower_rapl_cpuhp_exit(void);
 int zenpower_rapl_init(struct zenpower_data *data, struct device *dev);
-int zenpower_rapl_read_power(struct zenpower_data *data, int channel, long *val);
+int zenpower_rapl_read_power(struct zenpower_data *data, long *val);
+int zenpower_rapl_read_energy(struct zenpower_data *data, long *val);
+int zenpower_rapl_hwmon_power(struct zenpower_data *data,
+			      const struct zenpower_channel *ch, u32 attr, long *val);
+int zenpower_rapl_hwmon_energy(struct zenpower_data *data,
+			       const struct zenpower_channel *ch, u32 attr, long *val);
+void zenpower_rapl_sample(struct zenpower_data *data);
+u64 zenpower_rapl_get_energy(struct zenpower_data *data);
+int zenpower_rapl_hf_init(struct zenpower_data *data, struct device *dev, int cpu);
+ssize_t zenpower_rapl_hf_show(struct zenpower_data *data, char *buf);
+void zenpower_rapl_read_cores(const struct cpumask *mask,
+			      struct zenpower_core_sample __percpu *out);
+u64 zenpower_rapl_counts_to_uw(struct zenpower_data *data, u64 counts, u64 ns);
+
+/* SMU PM table backend functions */
+extern const struct zenpower_pmtable_layout zenpower_pmt_matisse;
+extern const struct zenpower_pmtable_layout zenpower_pmt_vermeer;
+
+int zenpower_pmtable_init(struct zenpower_data *data, struct device *dev,
+			  const struct zenpower_pmtable_layout *layout, bool mock);
+void zenpower_pmtable_sample(struct zenpower_data *data);
+bool zenpower_pmtable_has(const struct zenpower_data *data, enum zenpower_pmt_metric m);
+int zenpower_pmtable_read(struct zenpower_data *data, enum zenpower_pmt_metric m,
+			  long *val);
+ssize_t zenpower_pmtable_show(struct zenpower_data *data, char *buf);
+int zenpower_pmtable_hwmon_curr(struct zenpower_data *data,
+				const struct zenpower_channel *ch, u32 attr, long *val);
+int zenpower_pmtable_hwmon_power(struct zenpower_data *data,
+				 const struct zenpower_channel *ch, u32 attr, long *val);
 
 /* Temperature backend functions */
 unsigned int zenpower_temp_get_ccd(struct zenpower_data *data, u32 ccd_addr);
 unsigned int zenpower_temp_get_ctl(struct zenpower_data *data);
+int zenpower_temp_hwmon_tdie(struct zenpower_data *data,
+			     const struct zenpower_channel *ch, u32 attr, long *val);
+int zenpower_temp_hwmon_tctl(struct zenpower_data *data,
+			     const struct zenpower_channel *ch, u32 attr, long *val);
+int zenpower_temp_hwmon_ccd(struct zenpower_data *data,
+			    const struct zenpower_channel *ch, u32 attr, long *val);
+
+/* IIO functions */
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+int zenpower_iio_init(struct zenpower_data *data, struct device *dev);
+#else
+static inline int zenpower_iio_init(struct zenpower_data *data, struct device *dev)
+{
+	return 0;
+}
+#endif
+
+/* Histogram functions */
+int zenpower_hist_init(struct zenpower_data *data, struct device *dev);
+void zenpower_hist_sample(struct zenpower_data *data,
+			  const struct zenpower_sample *s);
+
+/* /dev/zenpower functions; zenpower_devices lists fully probed nodes */
+extern struct list_head zenpower_devices;
+extern struct mutex zenpower_devices_lock;
+
+int zenpower_chardev_init(void);
+void zenpower_chardev_exit(void);
+int zenpower_chardev_add(struct zenpower_data *data, struct device *dev);
+void zenpower_windows_sample(struct zenpower_data *data,
+			     const struct zenpower_sample *s);
+
+/* CCD placement functions */
+extern const struct attribute_group zenpower_ccd_group;
+
+int zenpower_ccd_init(struct zenpower_data *data, struct device *dev);
+void zenpower_ccd_sample(struct zenpower_data *data, const struct zenpower_sample *s);
+const struct cpumask *zenpower_ccd_cpus(struct zenpower_data *data, int ccd);
+
+/* Energy Model functions; runtime EM table updates appeared in 6.9 */
+#if IS_ENABLED(CONFIG_ENERGY_MODEL) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+#define ZENPOWER_EM
+int zenpower_em_init(struct zenpower_data *data, struct device *dev);
+void zenpower_em_sample(struct zenpower_data *data);
+#else
+static inline int zenpower_em_init(struct zenpower_data *data, struct device *dev)
+{
+	return 0;
+}
+
+static inline void zenpower_em_sample(struct zenpower_data *data)
+{
+}
+#endif
+
+/* History functions */
+int zenpower_history_init(struct zenpower_data *data, struct device *dev);
+void zenpower_history_sample(struct zenpower_data *data,
+			     const struct zenpower_sample *s);
+
+/* Power cap functions */
+extern const struct attribute_group zenpower_powercap_group;
+
+int zenpower_powercap_init(struct zenpower_data *data, struct device *dev);
+void zenpower_powercap_sample(struct zenpower_data *data,
+			      const struct zenpower_sample *s);
+int zenpower_powercap_hwmon_power(struct zenpower_data *data,
+				  const struct zenpower_channel *ch, u32 attr, long *val);
+int zenpower_powercap_hwmon_write(struct zenpower_data *data,
+				  const struct zenpower_channel *ch, u32 attr, long val);
+
+/* Aggregate device functions */
+int zenpower_package_init(void);
+void zenpower_package_exit(void);
+
+/* Throttle detector functions */
+extern const struct attribute_group zenpower_throttle_group;
+
+void zenpower_throttle_init(struct zenpower_data *data);
+void zenpower_throttle_sample(struct zenpower_data *data,
+			      const struct zenpower_sample *s);
 
 #endif /* ZENPOWER_H */
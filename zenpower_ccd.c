@@ -0,0 +1,286 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - CCD placement hints
+ *
+ * Maps each visible CCD to its CPUs and ranks the CCDs by temperature on
+ * every sampler pass, so a job launcher can pin work to the CCD with the
+ * most thermal headroom with a single read:
+ *
+ *   ccd_coolest_cpus        cpumask of the coolest CCD
+ *   ccd_coolest_cpus_list   the same mask as a CPU list
+ *   ccd_ranking             one line per CCD, coolest first:
+ *                           "<ccd> <temp in millidegrees> <cpu list>"
+ *
+ * All three are notified through poll() when the order changes, not on
+ * every temperature change.
+ *
+ * CPUs are grouped by L3 cache: the package's L3 domains, in ID order, are
+ * split evenly between its DF nodes and then between the node's visible
+ * CCDs (two L3 domains per CCD on Zen 2, one from Zen 3). The map is built
+ * from the CPUs online at probe; CPUs that are offline when a file is read
+ * are left out. Requires sample_interval_ms.
+ */
+
+#include "zenpower.h"
+#include <linux/cacheinfo.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/topology.h>
+
+/* L3 domains per package: 16 CCDs of one L3 each, or 8 CCDs of two */
+#define ZEN_CCD_MAX_L3      32
+
+struct zenpower_ccd_map {
+	cpumask_var_t cpus[8];
+
+	/* Ranking of the last sampler pass, under data->sample_lock */
+	u8 rank[8];
+	u8 nr_ranked;
+};
+
+static void zenpower_ccd_free(void *arg)
+{
+	struct zenpower_ccd_map *map = arg;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		free_cpumask_var(map->cpus[i]);
+	kfree(map);
+}
+
+static int zenpower_ccd_cmp_int(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Sorted, distinct L3 IDs of the package's online CPUs. Caller holds cpus_read_lock(). */
+static int zenpower_ccd_l3_ids(struct zenpower_data *data, int *ids)
+{
+	int cpu, id, i, n = 0;
+
+	for_each_online_cpu(cpu) {
+		if (topology_physical_package_id(cpu) != data->cpu_id)
+			continue;
+
+		id = get_cpu_cacheinfo_id(cpu, 3);
+		if (id < 0)
+			return -ENODEV;
+
+		for (i = 0; i < n && ids[i] != id; i++)
+			;
+		if (i < n)
+			continue;
+		if (n == ZEN_CCD_MAX_L3)
+			return -E2BIG;
+		ids[n++] = id;
+	}
+
+	sort(ids, n, sizeof(*ids), zenpower_ccd_cmp_int, NULL);
+	return n;
+}
+
+/* Build the CCD to CPU map. Must run after ccd_visible[] is known. */
+int zenpower_ccd_init(struct zenpower_data *data, struct device *dev)
+{
+	struct zenpower_ccd_map *map;
+	int ids[ZEN_CCD_MAX_L3], ccds[8];
+	int nr_ids, nr_ccds = 0, per_node, per_ccd, first;
+	int cpu, i, err;
+
+	for (i = 0; i < 8; i++) {
+		if (data->ccd_visible[i])
+			ccds[nr_ccds++] = i;
+	}
+	if (!nr_ccds || !data->sample_fast)
+		return 0;
+
+	map = kzalloc_node(sizeof(*map), GFP_KERNEL, data->numa_node);
+	if (!map)
+		return -ENOMEM;
+	for (i = 0; i < 8; i++) {
+		if (!zalloc_cpumask_var_node(&map->cpus[i], GFP_KERNEL, data->numa_node)) {
+			zenpower_ccd_free(map);
+			return -ENOMEM;
+		}
+	}
+
+	cpus_read_lock();
+	nr_ids = zenpower_ccd_l3_ids(data, ids);
+	err = nr_ids < 0 ? nr_ids : 0;
+
+	/* This node's share of the package's L3 domains, split between its CCDs */
+	per_node = nr_ids > 0 ? nr_ids / data->nodes_per_cpu : 0;
+	per_ccd = per_node / nr_ccds;
+	if (!err && (!per_ccd || nr_ids % data->nodes_per_cpu || per_node % nr_ccds))
+		err = -EINVAL;
+	first = (data->node_id % data->nodes_per_cpu) * per_node;
+
+	for_each_online_cpu(cpu) {
+		int id;
+
+		if (err)
+			break;
+		if (topology_physical_package_id(cpu) != data->cpu_id)
+			continue;
+
+		id = get_cpu_cacheinfo_id(cpu, 3);
+		for (i = first; i < first + per_node && ids[i] != id; i++)
+			;
+		if (i < first + per_node)
+			cpumask_set_cpu(cpu, map->cpus[ccds[(i - first) / per_ccd]]);
+	}
+	cpus_read_unlock();
+
+	if (err) {
+		zenpower_ccd_free(map);
+		return err;
+	}
+
+	data->ccd_map = map;
+	dev_info(dev, "CCD map: %d CCDs over %d L3 domains\n", nr_ccds, per_node);
+
+	return devm_add_action_or_reset(dev, zenpower_ccd_free, map);
+}
+
+/*
+ * Rank the CCDs of one sampler pass, coolest first, and notify pollers when
+ * the order changed. Called by the sampler outside sample_lock.
+ */
+void zenpower_ccd_sample(struct zenpower_data *data, const struct zenpower_sample *s)
+{
+	struct zenpower_ccd_map *map = data->ccd_map;
+	struct device *hwmon_dev;
+	u8 rank[8];
+	int i, j, n = 0;
+	bool changed;
+
+	/* Insertion sort by temperature; ties keep CCD order */
+	for (i = 0; i < 8; i++) {
+		if (!(s->tccd_valid & BIT(i)))
+			continue;
+		for (j = n; j > 0 && s->tccd[rank[j - 1]] > s->tccd[i]; j--)
+			rank[j] = rank[j - 1];
+		rank[j] = i;
+		n++;
+	}
+
+	spin_lock(&data->sample_lock);
+	changed = n != map->nr_ranked || memcmp(rank, map->rank, n);
+	memcpy(map->rank, rank, n);
+	map->nr_ranked = n;
+	spin_unlock(&data->sample_lock);
+
+	hwmon_dev = READ_ONCE(data->hwmon_dev);
+	if (!changed || !hwmon_dev)
+		return;
+
+	sysfs_notify(&hwmon_dev->kobj, NULL, "ccd_coolest_cpus");
+	sysfs_notify(&hwmon_dev->kobj, NULL, "ccd_coolest_cpus_list");
+	sysfs_notify(&hwmon_dev->kobj, NULL, "ccd_ranking");
+}
+
+/* CPUs of @ccd as mapped at probe, for other sampler consumers */
+const struct cpumask *zenpower_ccd_cpus(struct zenpower_data *data, int ccd)
+{
+	return data->ccd_map->cpus[ccd];
+}
+
+/* Snapshot of the ranking and the temperatures it was made from */
+static int zenpower_ccd_ranking(struct zenpower_data *data, u8 *rank, int *tccd)
+{
+	struct zenpower_ccd_map *map = data->ccd_map;
+	int n;
+
+	spin_lock(&data->sample_lock);
+	n = map->nr_ranked;
+	memcpy(rank, map->rank, n);
+	memcpy(tccd, data->last_sample.tccd, sizeof(data->last_sample.tccd));
+	spin_unlock(&data->sample_lock);
+
+	return n;
+}
+
+static ssize_t zenpower_ccd_coolest(struct device *dev, char *buf, bool list)
+{
+	struct zenpower_data *data = dev_get_drvdata(dev);
+	cpumask_var_t mask;
+	int tccd[8];
+	u8 rank[8];
+	ssize_t len;
+
+	if (!zenpower_ccd_ranking(data, rank, tccd))
+		return -EAGAIN;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	cpumask_and(mask, data->ccd_map->cpus[rank[0]], cpu_online_mask);
+	len = cpumap_print_to_pagebuf(list, buf, mask);
+	free_cpumask_var(mask);
+
+	return len;
+}
+
+static ssize_t ccd_coolest_cpus_show(struct device *dev,
+				     struct device_attribute *attr, char *buf)
+{
+	return zenpower_ccd_coolest(dev, buf, false);
+}
+
+static ssize_t ccd_coolest_cpus_list_show(struct device *dev,
+					  struct device_attribute *attr, char *buf)
+{
+	return zenpower_ccd_coolest(dev, buf, true);
+}
+
+static ssize_t ccd_ranking_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct zenpower_data *data = dev_get_drvdata(dev);
+	cpumask_var_t mask;
+	int tccd[8];
+	u8 rank[8];
+	int i, n, len = 0;
+
+	n = zenpower_ccd_ranking(data, rank, tccd);
+	if (!n)
+		return -EAGAIN;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		cpumask_and(mask, data->ccd_map->cpus[rank[i]], cpu_online_mask);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %d %*pbl\n",
+				 rank[i] + 1, tccd[rank[i]], cpumask_pr_args(mask));
+	}
+	free_cpumask_var(mask);
+
+	return len;
+}
+
+static DEVICE_ATTR_RO(ccd_coolest_cpus);
+static DEVICE_ATTR_RO(ccd_coolest_cpus_list);
+static DEVICE_ATTR_RO(ccd_ranking);
+
+static struct attribute *zenpower_ccd_attrs[] = {
+	&dev_attr_ccd_coolest_cpus.attr,
+	&dev_attr_ccd_coolest_cpus_list.attr,
+	&dev_attr_ccd_ranking.attr,
+	NULL
+};
+
+static umode_t zenpower_ccd_is_visible(struct kobject *kobj,
+				       struct attribute *attr, int index)
+{
+	struct zenpower_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+
+	return data->ccd_map ? attr->mode : 0;
+}
+
+const struct attribute_group zenpower_ccd_group = {
+	.attrs = zenpower_ccd_attrs,
+	.is_visible = zenpower_ccd_is_visible,
+};
@@ -0,0 +1,440 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - /dev/zenpower energy measurement windows
+ *
+ * A window records the kernel time and node energy when it is opened. While
+ * it is open, every sampler pass folds its package power and temperatures
+ * into the window's peak and maxima. Reading or closing the window returns
+ * energy, average power, peak power and temperature maxima for exactly that
+ * interval (see zenpower_uapi.h).
+ *
+ * Energy comes from the RAPL package accumulator, or from the SVI2 energy
+ * counters when RAPL is unavailable, and is read fresh at both ends of the
+ * window. Peak power and maxima need sample_interval_ms. Tctl is also read
+ * at both ends, so tctl_max is valid even without the sampler.
+ *
+ * The device is root-only, as windows measure RAPL energy (see
+ * zenpower_bind_channels()), and the number of open windows is limited
+ * per file descriptor and driver-wide.
+ *
+ * Locking: zenpower_devices_lock protects the device list and each
+ * window's data pointer, which is cleared when the device goes away. A
+ * window's sampler-maintained fields and its link on data->windows are
+ * protected by data->sample_lock.
+ */
+
+#include "zenpower.h"
+#include "zenpower_uapi.h"
+#include <linux/atomic.h>
+#include <linux/fs.h>
+#include <linux/idr.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+/* Open windows per file descriptor and in total */
+#define ZEN_WINDOWS_PER_FILE    256
+#define ZEN_WINDOWS_MAX         4096
+
+LIST_HEAD(zenpower_devices);
+DEFINE_MUTEX(zenpower_devices_lock);
+static DEFINE_IDA(zenpower_dev_ida);
+static atomic_t zenpower_nr_windows = ATOMIC_INIT(0);
+
+struct zenpower_window {
+	struct list_head list;          /* on data->windows */
+	struct zenpower_data *data;     /* NULL once the device is gone */
+	u16 node_id;
+	ktime_t start;
+	bool has_energy;
+	bool svi2;
+	u64 energy_start;               /* uJ */
+
+	/* Sampler-maintained, under data->sample_lock */
+	u32 samples;
+	bool has_peak;
+	u64 peak_power;                 /* uW */
+	int tctl_max;
+	bool has_tccd;
+	int tccd_max;
+};
+
+struct zenpower_file {
+	struct mutex lock;
+	struct idr windows;
+};
+
+/* Node energy in uJ: the RAPL package counter, else the SVI2 planes */
+static int zenpower_window_energy(struct zenpower_data *data, bool *svi2, u64 *uj)
+{
+	long val;
+
+	if (data->rapl_initialized && !zenpower_rapl_read_energy(data, &val)) {
+		*svi2 = false;
+		*uj = val;
+		return 0;
+	}
+
+	if (data->svi2_energy) {
+		*svi2 = true;
+		*uj = zenpower_svi2_get_energy(data, 0) +
+		      zenpower_svi2_get_energy(data, 1);
+		return 0;
+	}
+
+	return -EOPNOTSUPP;
+}
+
+/* Fold one sampler pass into the open windows. Caller holds sample_lock. */
+void zenpower_windows_sample(struct zenpower_data *data,
+			     const struct zenpower_sample *s)
+{
+	struct zenpower_window *w;
+	bool has_power = true;
+	u64 power = 0;
+
+	if (s->has_rapl_power)
+		power = s->rapl_power;
+	else if (data->svi2_energy)
+		power = (u64)s->svi2_power[0] + s->svi2_power[1];
+	else
+		has_power = false;
+
+	list_for_each_entry(w, &data->windows, list) {
+		w->samples++;
+		if (has_power) {
+			w->peak_power = max(w->peak_power, power);
+			w->has_peak = true;
+		}
+		if (s->has_temps) {
+			w->tctl_max = max(w->tctl_max, s->tctl);
+			if (s->tccd_max) {
+				w->tccd_max = w->has_tccd ? max(w->tccd_max, s->tccd_max) :
+						  s->tccd_max;
+				w->has_tccd = true;
+			}
+		}
+	}
+}
+
+/*
+ * Caller holds zenpower_devices_lock. Devices are looked up by dev_id, as
+ * node ids are all 0 on kernels without SMN node support.
+ */
+static struct zenpower_data *zenpower_find_dev(u32 dev_id)
+{
+	struct zenpower_data *data;
+
+	list_for_each_entry(data, &zenpower_devices, list) {
+		if (data->dev_id == dev_id)
+			return data;
+	}
+
+	return NULL;
+}
+
+/* Caller holds zenpower_devices_lock and has checked w->data */
+static void zenpower_window_result(struct zenpower_window *w,
+				   struct zenpower_window_result *r)
+{
+	struct zenpower_data *data = w->data;
+	int tctl = zenpower_temp_get_ctl(data);
+	ktime_t now = ktime_get();
+	bool svi2;
+	u64 energy;
+
+	r->flags = ZENPOWER_WINDOW_TEMP;
+	r->node_id = w->node_id;
+	r->duration_ns = ktime_to_ns(ktime_sub(now, w->start));
+
+	if (w->has_energy && !zenpower_window_energy(data, &svi2, &energy) &&
+	    svi2 == w->svi2 && energy >= w->energy_start) {
+		r->energy_uj = energy - w->energy_start;
+		/* uJ * 10^9 / ns = uW */
+		r->avg_power_uw = r->duration_ns ?
+			mul_u64_u64_div_u64(r->energy_uj, NSEC_PER_SEC, r->duration_ns) : 0;
+		r->flags |= ZENPOWER_WINDOW_ENERGY;
+		if (svi2)
+			r->flags |= ZENPOWER_WINDOW_SVI2;
+	}
+
+	spin_lock(&data->sample_lock);
+	r->samples = w->samples;
+	r->tctl_max = max(w->tctl_max, tctl);
+	if (w->has_peak) {
+		r->peak_power_uw = w->peak_power;
+		r->flags |= ZENPOWER_WINDOW_PEAK;
+	}
+	if (w->has_tccd) {
+		r->tccd_max = w->tccd_max;
+		r->flags |= ZENPOWER_WINDOW_TCCD;
+	}
+	spin_unlock(&data->sample_lock);
+}
+
+static void zenpower_window_free(struct zenpower_window *w)
+{
+	kfree(w);
+	atomic_dec(&zenpower_nr_windows);
+}
+
+/* Unlink @w from its device. Caller holds zenpower_devices_lock. */
+static void zenpower_window_detach(struct zenpower_window *w)
+{
+	struct zenpower_data *data = w->data;
+
+	if (!data)
+		return;
+
+	spin_lock(&data->sample_lock);
+	list_del(&w->list);
+	spin_unlock(&data->sample_lock);
+	w->data = NULL;
+}
+
+static long zenpower_ioctl_node_info(void __user *argp)
+{
+	struct zenpower_node_info info;
+	struct zenpower_data *data;
+	long ret = -ENOENT;
+	u32 i = 0;
+
+	if (copy_from_user(&info, argp, sizeof(info)))
+		return -EFAULT;
+
+	mutex_lock(&zenpower_devices_lock);
+	list_for_each_entry(data, &zenpower_devices, list) {
+		if (i++ != info.index)
+			continue;
+
+		info.dev_id = data->dev_id;
+		info.node_id = data->node_id;
+		info.flags = 0;
+		if (data->rapl_initialized)
+			info.flags |= ZENPOWER_NODE_RAPL;
+		if (data->svi2_energy)
+			info.flags |= ZENPOWER_NODE_SVI2;
+		if (data->sample_fast)
+			info.flags |= ZENPOWER_NODE_SAMPLER;
+		info.sample_interval_ms = data->sample_fast ? data->sample_interval_ms : 0;
+		ret = 0;
+		break;
+	}
+	mutex_unlock(&zenpower_devices_lock);
+
+	if (!ret && copy_to_user(argp, &info, sizeof(info)))
+		ret = -EFAULT;
+
+	return ret;
+}
+
+static long zenpower_ioctl_window_open(struct zenpower_file *zf, void __user *argp)
+{
+	struct zenpower_window_open req;
+	struct zenpower_data *data;
+	struct zenpower_window *w;
+	int id;
+
+	if (copy_from_user(&req, argp, sizeof(req)))
+		return -EFAULT;
+
+	if (!atomic_add_unless(&zenpower_nr_windows, 1, ZEN_WINDOWS_MAX))
+		return -ENOSPC;
+
+	w = kzalloc(sizeof(*w), GFP_KERNEL);
+	if (!w) {
+		atomic_dec(&zenpower_nr_windows);
+		return -ENOMEM;
+	}
+
+	mutex_lock(&zf->lock);
+	id = idr_alloc(&zf->windows, w, 1, ZEN_WINDOWS_PER_FILE + 1, GFP_KERNEL);
+	if (id < 0)
+		goto err_free;
+
+	mutex_lock(&zenpower_devices_lock);
+	data = zenpower_find_dev(req.dev_id);
+	if (!data) {
+		mutex_unlock(&zenpower_devices_lock);
+		idr_remove(&zf->windows, id);
+		id = -ENODEV;
+		goto err_free;
+	}
+
+	w->data = data;
+	w->node_id = data->node_id;
+	w->tctl_max = zenpower_temp_get_ctl(data);
+	w->has_energy = !zenpower_window_energy(data, &w->svi2, &w->energy_start);
+	w->start = ktime_get();
+
+	spin_lock(&data->sample_lock);
+	list_add_tail(&w->list, &data->windows);
+	spin_unlock(&data->sample_lock);
+	mutex_unlock(&zenpower_devices_lock);
+	mutex_unlock(&zf->lock);
+
+	req.id = id;
+	return copy_to_user(argp, &req, sizeof(req)) ? -EFAULT : 0;
+
+err_free:
+	mutex_unlock(&zf->lock);
+	zenpower_window_free(w);
+	return id;
+}
+
+static long zenpower_ioctl_window_result(struct zenpower_file *zf, void __user *argp,
+					 bool close)
+{
+	struct zenpower_window_result res;
+	struct zenpower_window *w;
+	long ret = 0;
+	u32 id;
+
+	if (copy_from_user(&id, argp, sizeof(id)))
+		return -EFAULT;
+
+	memset(&res, 0, sizeof(res));
+	res.id = id;
+
+	mutex_lock(&zf->lock);
+	w = idr_find(&zf->windows, id);
+	if (!w) {
+		mutex_unlock(&zf->lock);
+		return -ENOENT;
+	}
+
+	mutex_lock(&zenpower_devices_lock);
+	if (w->data)
+		zenpower_window_result(w, &res);
+	else
+		ret = -ENODEV;
+	if (close)
+		zenpower_window_detach(w);
+	mutex_unlock(&zenpower_devices_lock);
+
+	if (close) {
+		idr_remove(&zf->windows, id);
+		zenpower_window_free(w);
+	}
+	mutex_unlock(&zf->lock);
+
+	if (!ret && copy_to_user(argp, &res, sizeof(res)))
+		ret = -EFAULT;
+
+	return ret;
+}
+
+static long zenpower_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct zenpower_file *zf = file->private_data;
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case ZENPOWER_IOC_NODE_INFO:
+		return zenpower_ioctl_node_info(argp);
+	case ZENPOWER_IOC_WINDOW_OPEN:
+		return zenpower_ioctl_window_open(zf, argp);
+	case ZENPOWER_IOC_WINDOW_READ:
+		return zenpower_ioctl_window_result(zf, argp, false);
+	case ZENPOWER_IOC_WINDOW_CLOSE:
+		return zenpower_ioctl_window_result(zf, argp, true);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int zenpower_open(struct inode *inode, struct file *file)
+{
+	struct zenpower_file *zf;
+
+	zf = kzalloc(sizeof(*zf), GFP_KERNEL);
+	if (!zf)
+		return -ENOMEM;
+
+	mutex_init(&zf->lock);
+	idr_init(&zf->windows);
+	file->private_data = zf;
+
+	return nonseekable_open(inode, file);
+}
+
+static int zenpower_release(struct inode *inode, struct file *file)
+{
+	struct zenpower_file *zf = file->private_data;
+	struct zenpower_window *w;
+	int id;
+
+	mutex_lock(&zenpower_devices_lock);
+	idr_for_each_entry(&zf->windows, w, id) {
+		zenpower_window_detach(w);
+		zenpower_window_free(w);
+	}
+	mutex_unlock(&zenpower_devices_lock);
+
+	idr_destroy(&zf->windows);
+	kfree(zf);
+
+	return 0;
+}
+
+static const struct file_operations zenpower_fops = {
+	.owner = THIS_MODULE,
+	.open = zenpower_open,
+	.release = zenpower_release,
+	.unlocked_ioctl = zenpower_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+};
+
+static struct miscdevice zenpower_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "zenpower",
+	.fops = &zenpower_fops,
+	.mode = 0600,
+};
+
+static void zenpower_chardev_remove(void *arg)
+{
+	struct zenpower_data *data = arg;
+	struct zenpower_window *w, *tmp;
+
+	mutex_lock(&zenpower_devices_lock);
+	list_del(&data->list);
+
+	/* Windows still open on this node now report -ENODEV */
+	spin_lock(&data->sample_lock);
+	list_for_each_entry_safe(w, tmp, &data->windows, list) {
+		list_del(&w->list);
+		w->data = NULL;
+	}
+	spin_unlock(&data->sample_lock);
+	mutex_unlock(&zenpower_devices_lock);
+
+	ida_free(&zenpower_dev_ida, data->dev_id);
+}
+
+/* Make a fully probed device available to /dev/zenpower */
+int zenpower_chardev_add(struct zenpower_data *data, struct device *dev)
+{
+	data->dev_id = ida_alloc(&zenpower_dev_ida, GFP_KERNEL);
+	if (data->dev_id < 0)
+		return data->dev_id;
+
+	mutex_lock(&zenpower_devices_lock);
+	list_add_tail(&data->list, &zenpower_devices);
+	mutex_unlock(&zenpower_devices_lock);
+
+	return devm_add_action_or_reset(dev, zenpower_chardev_remove, data);
+}
+
+int zenpower_chardev_init(void)
+{
+	return misc_register(&zenpower_miscdev);
+}
+
+void zenpower_chardev_exit(void)
+{
+	misc_deregister(&zenpower_miscdev);
+}
@@ -35,9 +35,15 @@
 
 #include <linux/version.h>
 
+#include <linux/ctype.h>
+#include <linux/debugfs.h>
 #include <linux/hwmon.h>
 #include <linux/module.h>
 #include <linux/pci.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/topology.h>
 #include <asm/msr.h>
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 16, 0)
@@ -64,6 +70,21 @@ static bool zen1_calc;
 module_param(zen1_calc, bool, 0);
 MODULE_PARM_DESC(zen1_calc, "Set to 1 to use ZEN1 calculation");
 
+static bool pm_table;
+module_param(pm_table, bool, 0);
+MODULE_PARM_DESC(pm_table, "Set to 1 to read the SMU PM table through the SMU mailbox");
+
+static char *channels_off;
+module_param(channels_off, charp, 0444);
+MODULE_PARM_DESC(channels_off, "hwmon channels disabled at probe, e.g. temp3-10,in1,curr1 (default none)");
+
+/* /sys/kernel/debug/zenpower, one directory per node below it */
+static struct dentry *zenpower_debugfs_root;
+
+static bool pm_table_mock;
+module_param(pm_table_mock, bool, 0);
+MODULE_PARM_DESC(pm_table_mock, "Set to 1 to serve the PM table from a mock SMU mailbox");
+
 
 #ifndef PCI_DEVICE_ID_AMD_17H_DF_F3
 #define PCI_DEVICE_ID_AMD_17H_DF_F3         0x1463
@@ -135,23 +156,12 @@ MODULE_PARM_DESC(zen1_calc, "Set to 1 to use ZEN1 calculation");
 #define F1AH_M70H_SVI_TEL_PLANE1            0x00073014
 
 #define F17H_M70H_CCD_TEMP(x)               (0x00059954 + ((x) * 4))
-/* Zen5 CCD temp - uses offset 0x308 per k10temp driver */
-#define F1AH_M70H_CCD_TEMP(x)               (0x00059b08 + ((x) * 4))
 
 /* CCD temperature base addresses for configuration table */
 #define F17H_M70H_CCD_TEMP_BASE             0x00059954
+/* Zen5 CCD temp - uses offset 0x308 per k10temp driver */
 #define F1AH_M70H_CCD_TEMP_BASE             0x00059b08
 
-#ifndef HWMON_CHANNEL_INFO
-#define HWMON_CHANNEL_INFO(stype, ...)	\
-	(&(struct hwmon_channel_info) {		\
-		.type = hwmon_##stype,			\
-		.config = (u32 []) {			\
-			__VA_ARGS__, 0				\
-		}								\
-	})
-#endif
-
 struct tctl_offset {
 	u8 model;
 	char const *id;
@@ -167,122 +177,132 @@ static const struct tctl_offset tctl_offset_table[] = {
 	{ 0x17, "AMD Ryzen Threadripper 29", 27000 }, /* 29{20,50,70,90}[W]X */
 };
 
+/* Zen5 uses SVI3 (not SVI2), which is not supported yet: temperatures only */
+static const struct zenpower_backend_ops zenpower_svi3_ops = {
+	.name = "SVI3 (unsupported)",
+	.temp = zenpower_temp_hwmon_ccd,
+};
+
 /*
  * CPU model configuration table
  *
  * Each entry defines register addresses and capabilities for a specific
  * CPU family/model combination. Adding support for a new CPU requires
- * adding one entry to this table.
+ * adding one entry to this table; a new telemetry interface adds a
+ * struct zenpower_backend_ops for its entries to point at.
  *
  * Entries are ordered by family, then by model for readability.
  */
 static const struct zenpower_model_config model_configs[] = {
 	/* Family 17h - Zen, Zen+, Zen2 */
 	{ .family = 0x17, .model = 0x01,
+	  .backend = &zenpower_svi2_zen1_ops,
 	  .svi_core_addr = F17H_M01H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F17H_M01H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 4,
-	  .flags = 0,
 	  .name = "Zen/Zen+ (17h/01h)" },
 
 	{ .family = 0x17, .model = 0x08,
+	  .backend = &zenpower_svi2_zen1_ops,
 	  .svi_core_addr = F17H_M01H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F17H_M01H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 4,
-	  .flags = 0,
 	  .name = "Zen+ (17h/08h)" },
 
 	{ .family = 0x17, .model = 0x11,
+	  .backend = &zenpower_svi2_zen1_ops,
 	  .svi_core_addr = F17H_M01H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F17H_M01H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 0,
-	  .flags = 0,
 	  .name = "Zen APU (17h/11h)" },
 
 	{ .family = 0x17, .model = 0x18,
+	  .backend = &zenpower_svi2_zen1_ops,
 	  .svi_core_addr = F17H_M01H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F17H_M01H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 0,
-	  .flags = 0,
 	  .name = "Zen+ APU (17h/18h)" },
 
 	{ .family = 0x17, .model = 0x31,
+	  .backend = &zenpower_svi2_zen2_ops,
 	  .svi_core_addr = F17H_M30H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F17H_M30H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 8,
-	  .flags = ZEN_CFG_ZEN2_CALC | ZEN_CFG_MULTINODE,
+	  .flags = ZEN_CFG_MULTINODE,
 	  .name = "Zen2 TR/EPYC (17h/31h)" },
 
 	{ .family = 0x17, .model = 0x60,
+	  .backend = &zenpower_svi2_zen2_ops,
 	  .svi_core_addr = F17H_M60H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F17H_M60H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 8,
-	  .flags = ZEN_CFG_ZEN2_CALC,
 	  .name = "Zen2 APU (17h/60h)" },
 
 	{ .family = 0x17, .model = 0x71,
+	  .backend = &zenpower_svi2_zen2_ops,
 	  .svi_core_addr = F17H_M70H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F17H_M70H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 8,
-	  .flags = ZEN_CFG_ZEN2_CALC,
+	  .pmtable = &zenpower_pmt_matisse,
 	  .name = "Zen2 Ryzen (17h/71h)" },
 
 	/* Family 19h - Zen3 */
 	{ .family = 0x19, .model = 0x00,
+	  .backend = &zenpower_svi2_zen2_ops,
 	  .svi_core_addr = F19H_M01H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F19H_M01H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 8,
-	  .flags = ZEN_CFG_ZEN2_CALC,
 	  .name = "Zen3 SP3/TR (19h/00h)" },
 
 	{ .family = 0x19, .model = 0x01,
+	  .backend = &zenpower_svi2_zen2_ops,
 	  .svi_core_addr = F19H_M01H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F19H_M01H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 8,
-	  .flags = ZEN_CFG_ZEN2_CALC,
 	  .name = "Zen3 SP3/TR (19h/01h)" },
 
 	{ .family = 0x19, .model = 0x21,
+	  .backend = &zenpower_svi2_zen2_ops,
 	  .svi_core_addr = F19H_M21H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F19H_M21H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 2,
-	  .flags = ZEN_CFG_ZEN2_CALC,
+	  .pmtable = &zenpower_pmt_vermeer,
 	  .name = "Zen3 Ryzen (19h/21h)" },
 
 	{ .family = 0x19, .model = 0x50,
+	  .backend = &zenpower_svi2_zen2_ops,
 	  .svi_core_addr = F19H_M50H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F19H_M50H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F17H_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 2,
-	  .flags = ZEN_CFG_ZEN2_CALC,
 	  .name = "Zen3 APU (19h/50h)" },
 
 	/* Family 1Ah - Zen5 Granite Ridge (Desktop) */
 	{ .family = 0x1a, .model = 0x44,
+	  .backend = &zenpower_svi3_ops,
 	  .svi_core_addr = F1AH_M70H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F1AH_M70H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F1AH_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 2,
-	  .flags = ZEN_CFG_ZEN2_CALC | ZEN_CFG_RAPL | ZEN_CFG_IS_ZEN5 | ZEN_CFG_NO_RAPL_CORE,
 	  .name = "Zen5 Granite Ridge (1Ah/44h)" },
 
 	/* Family 1Ah - Zen5 */
 	{ .family = 0x1a, .model = 0x70,
+	  .backend = &zenpower_svi3_ops,
 	  .svi_core_addr = F1AH_M70H_SVI_TEL_PLANE0,
 	  .svi_soc_addr = F1AH_M70H_SVI_TEL_PLANE1,
 	  .ccd_temp_base = F1AH_M70H_CCD_TEMP_BASE,
 	  .num_ccds = 8,
-	  .flags = ZEN_CFG_ZEN2_CALC | ZEN_CFG_RAPL | ZEN_CFG_IS_ZEN5 | ZEN_CFG_NO_RAPL_CORE,
 	  .name = "Zen5 Strix Halo (1Ah/70h)" },
 
 	{ } /* sentinel - must be last */
@@ -291,59 +311,39 @@ static const struct zenpower_model_config model_configs[] = {
 static DEFINE_MUTEX(nb_smu_ind_mutex);
 static bool multicpu = false;
 
+/* hwmon *_enable attribute of each channel type */
+static const u32 zenpower_enable_attr[ZEN_NR_TYPES] = {
+	[hwmon_temp] = hwmon_temp_enable,
+	[hwmon_in] = hwmon_in_enable,
+	[hwmon_curr] = hwmon_curr_enable,
+	[hwmon_power] = hwmon_power_enable,
+	[hwmon_energy] = hwmon_energy_enable,
+};
+
+static bool zenpower_is_enable(enum hwmon_sensor_types type, u32 attr)
+{
+	return type != hwmon_chip && attr == zenpower_enable_attr[type];
+}
+
 static umode_t zenpower_is_visible(const void *rdata,
 									enum hwmon_sensor_types type,
 									u32 attr, int channel)
 {
 	const struct zenpower_data *data = rdata;
-
-	switch (type) {
-		case hwmon_temp:
-			if (channel >= 2 && data->ccd_visible[channel-2] == false) // Tccd1-8
-				return 0;
-			break;
-
-		case hwmon_curr:
-			/* Zen5 uses SVI3 (not SVI2), which is not supported yet */
-			if (data->zen5)
-				return 0;
-			if (data->amps_visible == false)
-				return 0;
-			if (channel == 0 && data->svi_core_addr == 0)
-				return 0;
-			if (channel == 1 && data->svi_soc_addr == 0)
-				return 0;
-			break;
-
-		case hwmon_power:
-			if (data->amps_visible == false)
-				return 0;
-			if (channel == 0 && data->svi_core_addr == 0)
-				return 0;
-			if (channel == 1 && data->svi_soc_addr == 0)
-				return 0;
-			/* Hide Core power if unavailable/meaningless (e.g., Strix Halo APU) */
-			if (data->no_rapl_core && channel == 1)
-				return 0;
-			break;
-
-		case hwmon_in:
-			if (channel == 0)	// fake item to align different indexing,
-				return 0;		// see note at zenpower_info
-			/* Zen5 uses SVI3 (not SVI2), which is not supported yet */
-			if (data->zen5)
-				return 0;
-			if (channel == 1 && data->svi_core_addr == 0)
-				return 0;
-			if (channel == 2 && data->svi_soc_addr == 0)
-				return 0;
-			break;
-
-		default:
-			break;
-	}
-
-	return 0444;
+	const struct zenpower_channel *ch;
+
+	if (type >= ZEN_NR_TYPES || channel >= ZEN_NR_CHANNELS)
+		return 0;
+
+	/* Bound by zenpower_bind_channels(); every bound channel has *_enable */
+	ch = &data->chan[type][channel];
+	if (ch->read && zenpower_is_enable(type, attr))
+		return 0644;
+	if (!(ch->attrs & BIT(attr)))
+		return 0;
+	if (ch->priv)
+		return (ch->wattrs & BIT(attr)) ? 0600 : 0400;
+	return (ch->wattrs & BIT(attr)) ? 0644 : 0444;
 }
 
 static int debug_addrs_arr[] = {
@@ -356,6 +356,23 @@ static int debug_addrs_arr[] = {
 	F1AH_M70H_SVI + 0xC
 };
 
+/* Registers of disabled CCDs and SVI2 planes are left out of the dump */
+static bool zenpower_debug_addr_on(const struct zenpower_data *data, u32 addr)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		if (data->ccd_visible[i] && addr == data->ccd_addr[i])
+			return zenpower_chan_on(data, hwmon_temp, i + 2);
+	}
+	if (data->svi_core_addr && addr == data->svi_core_addr)
+		return zenpower_plane_on(data, 0);
+	if (data->svi_soc_addr && addr == data->svi_soc_addr)
+		return zenpower_plane_on(data, 1);
+
+	return true;
+}
+
 static ssize_t debug_data_show(struct device *dev,
 				struct device_attribute *attr, char *buf)
 {
@@ -365,9 +382,12 @@ static ssize_t debug_data_show(struct device *dev,
 
 	len += sprintf(buf + len, "KERN_SUP: %d\n", data->kernel_smn_support);
 	len += sprintf(buf + len, "NODE%d; CPU%d; ", data->node_id, data->cpu_id);
-	len += sprintf(buf + len, "N/CPU: %d\n", data->nodes_per_cpu);
+	len += sprintf(buf + len, "N/CPU: %d; ", data->nodes_per_cpu);
+	len += sprintf(buf + len, "NUMA: %d\n", data->numa_node);
 
 	for (i = 0; i < ARRAY_SIZE(debug_addrs_arr); i++){
+		if (!zenpower_debug_addr_on(data, debug_addrs_arr[i]))
+			continue;
 		data->read_amdsmn_addr(data->pdev, data->node_id, debug_addrs_arr[i], &smndata);
 		len += sprintf(buf + len, "%08x = %08x\n", debug_addrs_arr[i], smndata);
 	}
@@ -375,111 +395,55 @@ static ssize_t debug_data_show(struct device *dev,
 	return len;
 }
 
-static int zenpower_read(struct device *dev, enum hwmon_sensor_types type,
-			u32 attr, int channel, long *val)
+static ssize_t pm_table_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
 {
 	struct zenpower_data *data = dev_get_drvdata(dev);
-	u32 plane;
 
-	switch (type) {
+	return zenpower_pmtable_show(data, buf);
+}
 
-		// Temperatures
-		case hwmon_temp:
-			switch (attr) {
-				case hwmon_temp_input:
-					switch (channel) {
-						case 0: // Tdie
-							*val = zenpower_temp_get_ctl(data) - data->temp_offset;
-							break;
-						case 1: // Tctl
-							*val = zenpower_temp_get_ctl(data);
-							break;
-						case 2 ... 9: // Tccd1-8
-							if (data->zen5) {
-								*val = zenpower_temp_get_ccd(data, F1AH_M70H_CCD_TEMP(channel-2));
-							} else {
-								*val = zenpower_temp_get_ccd(data, F17H_M70H_CCD_TEMP(channel-2));
-							}
-							break;
-						default:
-							return -EOPNOTSUPP;
-					}
-					break;
-
-				case hwmon_temp_max: // Tdie max
-					// source: https://www.amd.com/en/products/cpu/amd-ryzen-7-3700x
-					//         other cpus have also same* Tmax on AMD website
-					//         * = when taking into consideration a tctl offset
-					*val = 95 * 1000;
-					break;
-
-				default:
-					return -EOPNOTSUPP;
-			}
-			break;
+static ssize_t rapl_hf_stats_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct zenpower_data *data = dev_get_drvdata(dev);
 
-		// Voltage
-		case hwmon_in:
-			if (channel == 0)
-				return -EOPNOTSUPP;
-			channel -= 1;	// hwmon_in have different indexing, see note at zenpower_info
-							// fall through
-		// Power / Current
-		case hwmon_curr:
-		case hwmon_power:
-			if (attr != hwmon_in_input && attr != hwmon_curr_input &&
-				attr != hwmon_power_input) {
-				return -EOPNOTSUPP;
-			}
+	return zenpower_rapl_hf_show(data, buf);
+}
 
-			/* Zen5 uses RAPL for power monitoring (SVI3 not supported yet) */
-			if (type == hwmon_power && data->zen5) {
-				return zenpower_rapl_read_power(data, channel, val);
-			}
+static int zenpower_read(struct device *dev, enum hwmon_sensor_types type,
+			u32 attr, int channel, long *val)
+{
+	struct zenpower_data *data = dev_get_drvdata(dev);
+	const struct zenpower_channel *ch = &data->chan[type][channel];
 
-			switch (channel) {
-				case 0: // Core SVI2
-					data->read_amdsmn_addr(data->pdev, data->node_id,
-											data->svi_core_addr, &plane);
-					break;
-				case 1: // SoC SVI2
-					data->read_amdsmn_addr(data->pdev, data->node_id,
-											data->svi_soc_addr, &plane);
-					break;
-				default:
-					return -EOPNOTSUPP;
-			}
+	if (zenpower_is_enable(type, attr)) {
+		*val = zenpower_chan_on(data, type, channel);
+		return 0;
+	}
+	/* Writable attributes are settings, readable like *_enable */
+	if (!zenpower_chan_on(data, type, channel) && !(ch->wattrs & BIT(attr)))
+		return -ENODATA;
 
-			switch (type) {
-				case hwmon_in:
-					*val = zenpower_svi2_plane_to_vcc(plane);
-					break;
-				case hwmon_curr:
-					*val = (channel == 0) ?
-						zenpower_svi2_get_core_current(plane, data->zen2):
-						zenpower_svi2_get_soc_current(plane, data->zen2);
-					break;
-				case hwmon_power:
-					if (channel == 0) {
-						u64 p = (u64)zenpower_svi2_get_core_current(plane, data->zen2) *
-							 (u64)zenpower_svi2_plane_to_vcc(plane);
-						*val = (long)p;
-					} else {
-						u64 p = (u64)zenpower_svi2_get_soc_current(plane, data->zen2) *
-							 (u64)zenpower_svi2_plane_to_vcc(plane);
-						*val = (long)p;
-					}
-					break;
-				default:
-					break;
-			}
-			break;
+	/* Only bound channels are visible, see zenpower_is_visible() */
+	return ch->read(data, ch, attr, val);
+}
 
-		default:
-			return -EOPNOTSUPP;
+static int zenpower_write(struct device *dev, enum hwmon_sensor_types type,
+			  u32 attr, int channel, long val)
+{
+	struct zenpower_data *data = dev_get_drvdata(dev);
+	const struct zenpower_channel *ch = &data->chan[type][channel];
+
+	if (zenpower_is_enable(type, attr)) {
+		if (val != 0 && val != 1)
+			return -EINVAL;
+		assign_bit(channel, &data->chan_off[type], !val);
+		return 0;
 	}
 
-	return 0;
+	/* Only attributes in wattrs are writable */
+	return ch->write(data, ch, attr, val);
 }
 
 static const char *zenpower_temp_label[][10] = {
@@ -539,48 +503,63 @@ static const char *zenpower_in_label[][3] = {
 	}
 };
 
-static const char *zenpower_curr_label[][2] = {
+static const char *zenpower_curr_label[][4] = {
 	{
 		"SVI2_C_Core",
 		"SVI2_C_SoC",
+		"SMU_C_TDC",
+		"SMU_C_EDC",
 	},
 	{
 		"cpu0 SVI2_C_Core",
 		"cpu0 SVI2_C_SoC",
+		"cpu0 SMU_C_TDC",
+		"cpu0 SMU_C_EDC",
 	},
 	{
 		"cpu1 SVI2_C_Core",
 		"cpu1 SVI2_C_SoC",
+		"cpu1 SMU_C_TDC",
+		"cpu1 SMU_C_EDC",
 	}
 };
 
-static const char *zenpower_power_label[][2] = {
+static const char *zenpower_power_label[][4] = {
 	{
 		"SVI2_P_Core",
 		"SVI2_P_SoC",
+		"SMU_P_PPT",
+		"RAPL_P_Package",
 	},
 	{
 		"cpu0 SVI2_P_Core",
 		"cpu0 SVI2_P_SoC",
+		"cpu0 SMU_P_PPT",
+		"cpu0 RAPL_P_Package",
 	},
 	{
 		"cpu1 SVI2_P_Core",
 		"cpu1 SVI2_P_SoC",
+		"cpu1 SMU_P_PPT",
+		"cpu1 RAPL_P_Package",
 	}
 };
 
-static const char *zenpower_power_label_zen5[][2] = {
+static const char *zenpower_energy_label[][3] = {
 	{
-		"RAPL_P_Package",
-		"RAPL_P_Core",
+		"SVI2_E_Core",
+		"SVI2_E_SoC",
+		"RAPL_E_Package",
 	},
 	{
-		"cpu0 RAPL_P_Package",
-		"cpu0 RAPL_P_Core",
+		"cpu0 SVI2_E_Core",
+		"cpu0 SVI2_E_SoC",
+		"cpu0 RAPL_E_Package",
 	},
 	{
-		"cpu1 RAPL_P_Package",
-		"cpu1 RAPL_P_Core",
+		"cpu1 SVI2_E_Core",
+		"cpu1 SVI2_E_SoC",
+		"cpu1 RAPL_E_Package",
 	}
 };
 
@@ -588,15 +567,17 @@ static int zenpower_read_labels(struct device *dev,
 				enum hwmon_sensor_types type, u32 attr,
 				int channel, const char **str)
 {
-	struct zenpower_data *data;
+	struct zenpower_data *data = dev_get_drvdata(dev);
 	u8 i = 0;
 
 	if (multicpu) {
-		data = dev_get_drvdata(dev);
 		if (data->cpu_id <= 1)
 			i = data->cpu_id + 1;
 	}
 
+	/* Label column of the bound channel, see zenpower_bind() */
+	channel = data->chan[type][channel].label;
+
 	switch (type) {
 		case hwmon_temp:
 			*str = zenpower_temp_label[i][channel];
@@ -608,12 +589,10 @@ static int zenpower_read_labels(struct device *dev,
 			*str = zenpower_curr_label[i][channel];
 			break;
 		case hwmon_power:
-			data = dev_get_drvdata(dev);
-			if (data->zen5) {
-				*str = zenpower_power_label_zen5[i][channel];
-			} else {
-				*str = zenpower_power_label[i][channel];
-			}
+			*str = zenpower_power_label[i][channel];
+			break;
+		case hwmon_energy:
+			*str = zenpower_energy_label[i][channel];
 			break;
 		default:
 			return -EOPNOTSUPP;
@@ -638,34 +617,58 @@ static void nb_index_read(struct pci_dev *pdev, u16 node_id, u32 address, u32 *r
 	mutex_unlock(&nb_smu_ind_mutex);
 }
 
+static void kernel_smn_write(struct pci_dev *pdev, u16 node_id, u32 address, u32 regval)
+{
+	amd_smn_write(node_id, address, regval);
+}
+
+static void nb_index_write(struct pci_dev *pdev, u16 node_id, u32 address, u32 regval)
+{
+	mutex_lock(&nb_smu_ind_mutex);
+	pci_bus_write_config_dword(pdev->bus, PCI_DEVFN(0, 0), 0x60, address);
+	pci_bus_write_config_dword(pdev->bus, PCI_DEVFN(0, 0), 0x64, regval);
+	mutex_unlock(&nb_smu_ind_mutex);
+}
+
 static const struct hwmon_channel_info *zenpower_info[] = {
 	HWMON_CHANNEL_INFO(temp,
-			HWMON_T_INPUT | HWMON_T_MAX | HWMON_T_LABEL,	// Tdie
-			HWMON_T_INPUT | HWMON_T_LABEL,					// Tctl
-			HWMON_T_INPUT | HWMON_T_LABEL,					// Tccd1
-			HWMON_T_INPUT | HWMON_T_LABEL,					// Tccd2
-			HWMON_T_INPUT | HWMON_T_LABEL,					// Tccd3
-			HWMON_T_INPUT | HWMON_T_LABEL,					// Tccd4
-			HWMON_T_INPUT | HWMON_T_LABEL,					// Tccd5
-			HWMON_T_INPUT | HWMON_T_LABEL,					// Tccd6
-			HWMON_T_INPUT | HWMON_T_LABEL,					// Tccd7
-			HWMON_T_INPUT | HWMON_T_LABEL),					// Tccd8
-
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_MAX | HWMON_T_LABEL,	// Tdie
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL,			// Tctl
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL,			// Tccd1
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL,			// Tccd2
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL,			// Tccd3
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL,			// Tccd4
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL,			// Tccd5
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL,			// Tccd6
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL,			// Tccd7
+			HWMON_T_ENABLE | HWMON_T_INPUT | HWMON_T_LABEL),		// Tccd8
+
+	/*
+	 * Everything is using 1 based indexing except hwmon_in - that is using
+	 * 0 based indexing. Let's make a fake item so corresponding SVI2 data
+	 * is associated with the same index.
+	 */
 	HWMON_CHANNEL_INFO(in,
-			HWMON_I_LABEL,	// everything is using 1 based indexing except
-							// hwmon_in - that is using 0 based indexing
-							// let's make fake item so corresponding SVI2 data is
-							// associated with same index
-			HWMON_I_INPUT | HWMON_I_LABEL,		// Core Voltage (SVI2)
-			HWMON_I_INPUT | HWMON_I_LABEL),		// SoC Voltage (SVI2)
+			HWMON_I_LABEL,							// unused in0
+			HWMON_I_ENABLE | HWMON_I_INPUT | HWMON_I_LABEL,			// Core Voltage (SVI2)
+			HWMON_I_ENABLE | HWMON_I_INPUT | HWMON_I_LABEL),		// SoC Voltage (SVI2)
 
 	HWMON_CHANNEL_INFO(curr,
-			HWMON_C_INPUT | HWMON_C_LABEL,		// Core Current (SVI2)
-			HWMON_C_INPUT | HWMON_C_LABEL),		// SoC Current (SVI2)
+			HWMON_C_ENABLE | HWMON_C_INPUT | HWMON_C_LABEL,			// Core Current (SVI2)
+			HWMON_C_ENABLE | HWMON_C_INPUT | HWMON_C_LABEL,			// SoC Current (SVI2)
+			HWMON_C_ENABLE | HWMON_C_INPUT | HWMON_C_MAX | HWMON_C_LABEL,	// TDC (PM table)
+			HWMON_C_ENABLE | HWMON_C_INPUT | HWMON_C_MAX | HWMON_C_LABEL),	// EDC (PM table)
 
 	HWMON_CHANNEL_INFO(power,
-			HWMON_P_INPUT | HWMON_P_LABEL,		// Core Power (SVI2)
-			HWMON_P_INPUT | HWMON_P_LABEL),		// SoC Power (SVI2)
+			HWMON_P_ENABLE | HWMON_P_INPUT | HWMON_P_CAP | HWMON_P_LABEL,	// Core Power (SVI2), Package Power (RAPL) on Zen 5
+			HWMON_P_ENABLE | HWMON_P_INPUT | HWMON_P_LABEL,			// SoC Power (SVI2)
+			HWMON_P_ENABLE | HWMON_P_INPUT | HWMON_P_CAP | HWMON_P_LABEL,	// PPT (PM table)
+			HWMON_P_ENABLE | HWMON_P_INPUT | HWMON_P_CAP | HWMON_P_LABEL),	// Package Power (RAPL)
+
+	HWMON_CHANNEL_INFO(energy,
+			HWMON_E_ENABLE | HWMON_E_INPUT | HWMON_E_LABEL,			// Core Energy (SVI2, integrated)
+			HWMON_E_ENABLE | HWMON_E_INPUT | HWMON_E_LABEL,			// SoC Energy (SVI2, integrated)
+			HWMON_E_ENABLE | HWMON_E_INPUT | HWMON_E_LABEL),		// Package Energy (RAPL)
 
 	NULL
 };
@@ -673,6 +676,7 @@ static const struct hwmon_channel_info *zenpower_info[] = {
 static const struct hwmon_ops zenpower_hwmon_ops = {
 	.is_visible = zenpower_is_visible,
 	.read = zenpower_read,
+	.write = zenpower_write,
 	.read_string = zenpower_read_labels,
 };
 
@@ -682,16 +686,150 @@ static const struct hwmon_chip_info zenpower_chip_info = {
 };
 
 static DEVICE_ATTR_RO(debug_data);
+static DEVICE_ATTR_RO(pm_table);
+static DEVICE_ATTR_RO(rapl_hf_stats);
 
 static struct attribute *zenpower_attrs[] = {
 	&dev_attr_debug_data.attr,
+	&dev_attr_pm_table.attr,
+	&dev_attr_rapl_hf_stats.attr,
 	NULL
 };
 
+static umode_t zenpower_attr_is_visible(struct kobject *kobj,
+					struct attribute *attr, int index)
+{
+	struct zenpower_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+
+	if (attr == &dev_attr_pm_table.attr && !data->pmt)
+		return 0;
+	if (attr == &dev_attr_rapl_hf_stats.attr && !data->rapl_hf)
+		return 0;
+
+	return attr->mode;
+}
+
 static const struct attribute_group zenpower_group = {
-	.attrs = zenpower_attrs
+	.attrs = zenpower_attrs,
+	.is_visible = zenpower_attr_is_visible,
 };
-__ATTRIBUTE_GROUPS(zenpower);
+
+static const struct attribute_group *zenpower_groups[] = {
+	&zenpower_group,
+	&zenpower_throttle_group,
+	&zenpower_ccd_group,
+	&zenpower_powercap_group,
+	NULL
+};
+
+/*
+ * NUMA node owning a DF node
+ *
+ * The DF PCI functions of every node sit on the first host bridge, so the
+ * PCI device's own node is usually that of socket 0. Use the CPUs of the
+ * package instead: if the package spans one NUMA node per DF node (NPS4 on
+ * Zen 1 EPYC) and firmware placed the DF device on the matching one, use it,
+ * otherwise the package's first node.
+ */
+static int zenpower_cmp_node(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static int zenpower_numa_node(struct pci_dev *pdev, u8 cpu_id,
+			      u8 node_of_cpu, u8 nodes_per_cpu)
+{
+	int nodes[8], nr_nodes = 0;
+	int cpu, i, nid;
+
+	for_each_online_cpu(cpu) {
+		if (topology_physical_package_id(cpu) != cpu_id)
+			continue;
+
+		nid = cpu_to_node(cpu);
+		for (i = 0; i < nr_nodes; i++) {
+			if (nodes[i] == nid)
+				break;
+		}
+		if (i == nr_nodes && nr_nodes < ARRAY_SIZE(nodes))
+			nodes[nr_nodes++] = nid;
+	}
+
+	if (nr_nodes == 0)
+		return dev_to_node(&pdev->dev);
+
+	/* Nothing guarantees that CPU enumeration follows node order */
+	sort(nodes, nr_nodes, sizeof(nodes[0]), zenpower_cmp_node, NULL);
+
+	/* The DF node to NUMA node mapping is only trusted when it can be checked */
+	if (nr_nodes == nodes_per_cpu &&
+	    nodes[node_of_cpu] == dev_to_node(&pdev->dev))
+		return nodes[node_of_cpu];
+
+	return nodes[0];
+}
+
+static void zenpower_free_data(void *data)
+{
+	kfree(data);
+}
+
+static struct zenpower_data *zenpower_alloc_data(struct device *dev, int numa_node)
+{
+	struct zenpower_data *data;
+
+	data = kzalloc_node(sizeof(*data), GFP_KERNEL, numa_node);
+	if (!data)
+		return NULL;
+
+	if (devm_add_action_or_reset(dev, zenpower_free_data, data))
+		return NULL;
+
+	data->numa_node = numa_node;
+	return data;
+}
+
+static void zenpower_debugfs_remove(void *arg)
+{
+	debugfs_remove_recursive(arg);
+}
+
+/* Per-node debugfs directory, named after the PCI device */
+static void zenpower_debugfs_init(struct zenpower_data *data, struct device *dev)
+{
+	struct dentry *dir;
+
+	if (IS_ERR_OR_NULL(zenpower_debugfs_root))
+		return;
+
+	dir = debugfs_create_dir(dev_name(dev), zenpower_debugfs_root);
+	if (IS_ERR(dir))
+		return;
+
+	if (devm_add_action_or_reset(dev, zenpower_debugfs_remove, dir))
+		return;
+
+	data->debugfs = dir;
+}
+
+/*
+ * Device-managed zeroed allocation on the node owning @data, for backend
+ * state that is touched on every read.
+ */
+void *zenpower_devm_kzalloc(struct zenpower_data *data, struct device *dev,
+			    size_t size)
+{
+	void *p;
+
+	p = kzalloc_node(size, GFP_KERNEL, data->numa_node);
+	if (!p)
+		return NULL;
+
+	if (devm_add_action_or_reset(dev, zenpower_free_data, p))
+		return NULL;
+
+	return p;
+}
 
 /*
  * Look up CPU model configuration
@@ -711,52 +849,255 @@ lookup_model_config(u8 family, u8 model)
 	return NULL;
 }
 
+/* Stop sampler notifications before the hwmon device goes away */
+static void zenpower_hwmon_detach(void *arg)
+{
+	struct zenpower_data *data = arg;
+
+	WRITE_ONCE(data->hwmon_dev, NULL);
+
+	/* Wait out a pass that may still hold the old pointer */
+	zenpower_sampler_sync(data);
+}
+
+static struct zenpower_channel *zenpower_bind(struct zenpower_data *data,
+					      enum hwmon_sensor_types type, int channel,
+					      zenpower_read_fn read, u32 attrs)
+{
+	struct zenpower_channel *ch = &data->chan[type][channel];
+
+	ch->read = read;
+	ch->attrs = read ? attrs : 0;
+	ch->label = channel;
+	return ch;
+}
+
+static const char *const zenpower_type_names[ZEN_NR_TYPES] = {
+	[hwmon_temp] = "temp",
+	[hwmon_in] = "in",
+	[hwmon_curr] = "curr",
+	[hwmon_power] = "power",
+	[hwmon_energy] = "energy",
+};
+
+/*
+ * Disable the channels named by channels_off, in sysfs numbering (temp1, in1).
+ * Returns -EINVAL for an entry that is not a channel or range of one type.
+ */
+static int zenpower_channels_off(struct zenpower_data *data)
+{
+	unsigned int first, last, ch, base;
+	char *buf, *cur, *tok, *end;
+	size_t len = 0;
+	int type, err = 0;
+
+	if (!channels_off || !*channels_off)
+		return 0;
+
+	buf = kstrdup(channels_off, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	cur = buf;
+	while ((tok = strsep(&cur, ",")) != NULL) {
+		for (type = hwmon_temp; type < ZEN_NR_TYPES; type++) {
+			len = strlen(zenpower_type_names[type]);
+			if (!strncmp(tok, zenpower_type_names[type], len) && isdigit(tok[len]))
+				break;
+		}
+		if (type == ZEN_NR_TYPES) {
+			err = -EINVAL;
+			break;
+		}
+
+		/* <type><first>[-<last>], digits only */
+		end = strchr(tok + len, '-');
+		if (end)
+			*end++ = '\0';
+		if (kstrtouint(tok + len, 10, &first) ||
+		    (end && kstrtouint(end, 10, &last))) {
+			err = -EINVAL;
+			break;
+		}
+		if (!end)
+			last = first;
+
+		/* hwmon_in is 0-based in sysfs, the other types 1-based */
+		base = type == hwmon_in ? 0 : 1;
+		if (first < base || last < first || last - base >= ZEN_NR_CHANNELS) {
+			err = -EINVAL;
+			break;
+		}
+
+		for (ch = first; ch <= last; ch++)
+			set_bit(ch - base, &data->chan_off[type]);
+	}
+
+	if (err)
+		dev_err(&data->pdev->dev, "channels_off: invalid entry in '%s'\n",
+			channels_off);
+	kfree(buf);
+	return err;
+}
+
+/*
+ * Bind each hwmon channel to the handler serving it, once the backends are
+ * set up. Channels left unbound stay hidden, so zenpower_read() is a direct
+ * call and zenpower_is_visible() a lookup.
+ */
+static int zenpower_bind_channels(struct zenpower_data *data)
+{
+	const struct zenpower_backend_ops *backend = data->backend;
+	u32 plane_addr[2] = { data->svi_core_addr, data->svi_soc_addr };
+	struct zenpower_channel *ch;
+	int type, i, pkg;
+
+	zenpower_bind(data, hwmon_temp, 0, zenpower_temp_hwmon_tdie,
+		      HWMON_T_INPUT | HWMON_T_MAX | HWMON_T_LABEL);
+	zenpower_bind(data, hwmon_temp, 1, zenpower_temp_hwmon_tctl,
+		      HWMON_T_INPUT | HWMON_T_LABEL);
+	for (i = 0; i < 8; i++) {
+		if (!data->ccd_visible[i])
+			continue;
+		ch = zenpower_bind(data, hwmon_temp, i + 2, backend->temp,
+				   HWMON_T_INPUT | HWMON_T_LABEL);
+		ch->addr = data->ccd_addr[i];
+	}
+
+	/* SVI2 planes; in0 stays unbound, see note at zenpower_info */
+	for (i = 0; i < 2; i++) {
+		if (!plane_addr[i])
+			continue;
+		ch = zenpower_bind(data, hwmon_in, i + 1, backend->in,
+				   HWMON_I_INPUT | HWMON_I_LABEL);
+		ch->addr = plane_addr[i];
+		ch->index = i;
+		ch = zenpower_bind(data, hwmon_curr, i, backend->curr,
+				   HWMON_C_INPUT | HWMON_C_LABEL);
+		ch->addr = plane_addr[i];
+		ch->index = i;
+		ch = zenpower_bind(data, hwmon_power, i, backend->power,
+				   HWMON_P_INPUT | HWMON_P_LABEL);
+		ch->addr = plane_addr[i];
+		ch->index = i;
+		/* Integrated by the sampler, see zenpower_svi2_sample() */
+		if (data->svi2_energy) {
+			ch = zenpower_bind(data, hwmon_energy, i, backend->energy,
+					   HWMON_E_INPUT | HWMON_E_LABEL);
+			ch->index = i;
+		}
+	}
+
+	/* TDC/EDC and PPT from the SMU PM table */
+	for (i = 0; i < 2; i++) {
+		enum zenpower_pmt_metric value = i ? ZEN_PMT_EDC_VALUE : ZEN_PMT_TDC_VALUE;
+		enum zenpower_pmt_metric limit = i ? ZEN_PMT_EDC_LIMIT : ZEN_PMT_TDC_LIMIT;
+
+		if (!zenpower_pmtable_has(data, value))
+			continue;
+		ch = zenpower_bind(data, hwmon_curr, i + 2, zenpower_pmtable_hwmon_curr,
+				   HWMON_C_INPUT | HWMON_C_LABEL |
+				   (zenpower_pmtable_has(data, limit) ? HWMON_C_MAX : 0));
+		ch->index = value;
+		ch->limit = limit;
+	}
+	if (zenpower_pmtable_has(data, ZEN_PMT_PPT_VALUE)) {
+		ch = zenpower_bind(data, hwmon_power, 2, zenpower_pmtable_hwmon_power,
+				   HWMON_P_INPUT | HWMON_P_LABEL |
+				   (zenpower_pmtable_has(data, ZEN_PMT_PPT_LIMIT) ?
+				    HWMON_P_CAP : 0));
+		ch->index = ZEN_PMT_PPT_VALUE;
+		ch->limit = ZEN_PMT_PPT_LIMIT;
+	}
+
+	/*
+	 * RAPL package counter. Zen 5 has no plane power and has always listed
+	 * it as power1, so it keeps that slot there. Fine-grained RAPL energy
+	 * is a power side channel (PLATYPUS, CVE-2020-8694), so it is root-only.
+	 */
+	pkg = backend->power ? 3 : 0;
+	if (data->rapl_initialized) {
+		ch = zenpower_bind(data, hwmon_power, pkg, zenpower_rapl_hwmon_power,
+				   HWMON_P_INPUT | HWMON_P_LABEL);
+		ch->label = 3;
+		ch->priv = true;
+		ch = zenpower_bind(data, hwmon_energy, 2, zenpower_rapl_hwmon_energy,
+				   HWMON_E_INPUT | HWMON_E_LABEL);
+		ch->priv = true;
+	}
+
+	/* Package power cap, enforced by the sampler, see zenpower_powercap.c */
+	if (data->pcap) {
+		ch = zenpower_bind(data, hwmon_power, pkg, zenpower_powercap_hwmon_power,
+				   HWMON_P_INPUT | HWMON_P_CAP | HWMON_P_LABEL);
+		ch->label = 3;
+		ch->priv = true;
+		ch->write = zenpower_powercap_hwmon_write;
+		ch->wattrs = HWMON_P_CAP;
+	}
+
+	/* Unbound channels are left out of the sweeps like disabled ones */
+	for (type = hwmon_temp; type < ZEN_NR_TYPES; type++) {
+		for (i = 0; i < ZEN_NR_CHANNELS; i++) {
+			if (!data->chan[type][i].read)
+				set_bit(i, &data->chan_off[type]);
+		}
+	}
+	return zenpower_channels_off(data);
+}
+
 static int zenpower_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 {
 	struct device *dev = &pdev->dev;
 	struct zenpower_data *data;
 	struct device *hwmon_dev;
 	struct pci_dev *misc;
-	int i, ccd_check = 0;
-	bool multinode;
-	u8 node_of_cpu;
+	int i, err, ccd_check = 0;
+	bool multinode, kernel_smn_support = false;
+	u8 node_of_cpu, nodes_per_cpu;
+	u16 node_id = 0;
 	u32 val;
 
-	data = devm_kzalloc(dev, sizeof(*data), GFP_KERNEL);
+	for (i = 0; i < amd_nb_num(); i++) {
+		misc = node_to_amd_nb(i)->misc;
+		if (pdev->vendor == misc->vendor && pdev->device == misc->device) {
+			kernel_smn_support = true;
+			node_id = amd_pci_dev_to_node_id(pdev);
+			break;
+		}
+	}
+
+	// CPUID_Fn8000001E_ECX [Node Identifiers] (Core::X86::Cpuid::NodeId)
+	// 10:8 NodesPerProcessor
+	nodes_per_cpu = 1 + ((cpuid_ecx(0x8000001E) >> 8) & 0b111);
+	multinode = (nodes_per_cpu > 1);
+	node_of_cpu = node_id % nodes_per_cpu;
+
+	/* Keep per-node state in memory local to the node it describes */
+	data = zenpower_alloc_data(dev, zenpower_numa_node(pdev,
+				node_id / nodes_per_cpu, node_of_cpu, nodes_per_cpu));
 	if (!data)
 		return -ENOMEM;
 
-	data->zen2 = false;
 	data->pdev = pdev;
 	data->temp_offset = 0;
 	data->read_amdsmn_addr = nb_index_read;
-	data->kernel_smn_support = false;
+	data->write_amdsmn_addr = nb_index_write;
+	data->kernel_smn_support = kernel_smn_support;
 	data->svi_core_addr = false;
 	data->svi_soc_addr = false;
-	data->amps_visible = false;
-	data->no_rapl_core = false;
-	data->node_id = 0;
+	data->node_id = node_id;
 	for (i = 0; i < 8; i++) {
 		data->ccd_visible[i] = false;
 	}
 
-	for (i = 0; i < amd_nb_num(); i++) {
-		misc = node_to_amd_nb(i)->misc;
-		if (pdev->vendor == misc->vendor && pdev->device == misc->device) {
-			data->kernel_smn_support = true;
-			data->read_amdsmn_addr = kernel_smn_read;
-			data->node_id = amd_pci_dev_to_node_id(pdev);
-			break;
-		}
+	if (kernel_smn_support) {
+		data->read_amdsmn_addr = kernel_smn_read;
+		data->write_amdsmn_addr = kernel_smn_write;
 	}
 
-	// CPUID_Fn8000001E_ECX [Node Identifiers] (Core::X86::Cpuid::NodeId)
-	// 10:8 NodesPerProcessor
-	data->nodes_per_cpu = 1 + ((cpuid_ecx(0x8000001E) >> 8) & 0b111);
-	multinode = (data->nodes_per_cpu > 1);
-
-	node_of_cpu = data->node_id % data->nodes_per_cpu;
-	data->cpu_id = data->node_id / data->nodes_per_cpu;
+	data->nodes_per_cpu = nodes_per_cpu;
+	data->cpu_id = node_id / nodes_per_cpu;
 
 	if (data->cpu_id > 0)
 		multicpu = true;
@@ -780,32 +1121,28 @@ static int zenpower_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 		/* Apply base configuration from table */
 		data->svi_core_addr = config->svi_core_addr;
 		data->svi_soc_addr = config->svi_soc_addr;
-		data->amps_visible = true;
 		ccd_check = config->num_ccds;
-
-		/* Apply Zen2 calculation formula (unless zen1_calc override) */
-		if (config->flags & ZEN_CFG_ZEN2_CALC) {
-			if (!zen1_calc) {
-				data->zen2 = true;
-			}
+		for (i = 0; i < 8; i++) {
+			data->ccd_addr[i] = config->ccd_temp_base + i * 4;
 		}
 
-		/* Set Zen5 architecture flag */
-		if (config->flags & ZEN_CFG_IS_ZEN5) {
-			data->zen5 = true;
+		/* Bind the telemetry backend (Zen1 formula on zen1_calc override) */
+		data->backend = config->backend;
+		if (zen1_calc && data->backend == &zenpower_svi2_zen2_ops) {
+			data->backend = &zenpower_svi2_zen1_ops;
 		}
 
-		/* Set RAPL Core power availability flag */
-		if (config->flags & ZEN_CFG_NO_RAPL_CORE) {
-			data->no_rapl_core = true;
+		/* RAPL energy MSRs, probed on every family */
+		if (zenpower_rapl_init(data, dev)) {
+			dev_info(dev, "RAPL energy MSRs not available\n");
 		}
 
-		/* Handle Zen5 RAPL initialization */
-		if (config->flags & ZEN_CFG_RAPL) {
-			if (zenpower_rapl_init(data, dev)) {
-				dev_warn(dev, "RAPL initialization failed, power monitoring unavailable\n");
-				data->amps_visible = false;
-			}
+		/* SMU PM table (opt-in, as it sends SMU mailbox messages) */
+		if (pm_table || pm_table_mock) {
+			err = zenpower_pmtable_init(data, dev, config->pmtable,
+						    pm_table_mock);
+			if (err)
+				dev_info(dev, "PM table unavailable (%d)\n", err);
 		}
 
 		/* Handle multinode configuration (Threadripper/EPYC) */
@@ -821,22 +1158,29 @@ static int zenpower_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 			}
 		}
 
+		/* Backends without plane handlers expose no SVI telemetry */
+		if (!data->backend->in) {
+			data->svi_core_addr = 0;
+			data->svi_soc_addr = 0;
+		}
+
 		/* Log configured measurement backends */
 		dev_info(dev, "Measurement methods:\n");
-		if (config->flags & ZEN_CFG_RAPL) {
-			dev_info(dev, "  Power: RAPL MSRs (Package only)\n");
-		} else {
-			dev_info(dev, "  Power: SVI2 via SMN (Core + SoC)\n");
+		dev_info(dev, "  Backend: %s\n", data->backend->name);
+		if (data->rapl_initialized) {
+			dev_info(dev, "  Power/energy: RAPL MSRs (package %u, CPU %d)\n",
+				data->cpu_id, data->rapl_cpu);
 		}
 		if (data->svi_core_addr) {
-			dev_info(dev, "  Core voltage/current: SVI2 via SMN (addr 0x%08x, %s formula)\n",
-				data->svi_core_addr,
-				(data->zen2 && !zen1_calc) ? "ZEN2" : "ZEN1");
+			dev_info(dev, "  Core voltage/current: SVI2 via SMN (addr 0x%08x)\n",
+				data->svi_core_addr);
 		}
 		if (data->svi_soc_addr) {
-			dev_info(dev, "  SoC voltage/current: SVI2 via SMN (addr 0x%08x, %s formula)\n",
-				data->svi_soc_addr,
-				(data->zen2 && !zen1_calc) ? "ZEN2" : "ZEN1");
+			dev_info(dev, "  SoC voltage/current: SVI2 via SMN (addr 0x%08x)\n",
+				data->svi_soc_addr);
+		}
+		if (data->pmt) {
+			dev_info(dev, "  PPT/TDC/EDC: SMU PM table\n");
 		}
 		dev_info(dev, "  Tctl temperature: SMN register (MSR 0x59800)\n");
 		if (config->num_ccds > 0) {
@@ -846,8 +1190,7 @@ static int zenpower_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 	}
 
 	for (i = 0; i < ccd_check; i++) {
-		u32 ccd_addr = data->zen5 ? F1AH_M70H_CCD_TEMP(i) : F17H_M70H_CCD_TEMP(i);
-		data->read_amdsmn_addr(pdev, data->node_id, ccd_addr, &val);
+		data->read_amdsmn_addr(pdev, data->node_id, data->ccd_addr[i], &val);
 		/* Check valid bit (BIT(11)) per k10temp driver */
 		if (val & BIT(11)) {
 			data->ccd_visible[i] = true;
@@ -864,11 +1207,32 @@ static int zenpower_probe(struct pci_dev *pdev, const struct pci_device_id *id)
 		}
 	}
 
+	zenpower_debugfs_init(data, dev);
+
+	err = zenpower_sampler_init(data, dev);
+	if (err)
+		return err;
+
+	err = zenpower_bind_channels(data);
+	if (err)
+		return err;
+
 	hwmon_dev = devm_hwmon_device_register_with_info(
 		dev, "zenpower", data, &zenpower_chip_info, zenpower_groups
 	);
+	if (IS_ERR(hwmon_dev))
+		return PTR_ERR(hwmon_dev);
+
+	WRITE_ONCE(data->hwmon_dev, hwmon_dev);
+	err = devm_add_action_or_reset(dev, zenpower_hwmon_detach, data);
+	if (err)
+		return err;
+
+	err = zenpower_iio_init(data, dev);
+	if (err)
+		dev_info(dev, "IIO device unavailable (%d)\n", err);
 
-	return PTR_ERR_OR_ZERO(hwmon_dev);
+	return zenpower_chardev_add(data, dev);
 }
 
 static const struct pci_device_id zenpower_id_table[] = {
@@ -892,4 +1256,47 @@ static struct pci_driver zenpower_driver = {
 	.probe = zenpower_probe,
 };
 
-module_pci_driver(zenpower_driver);
+static int __init zenpower_init(void)
+{
+	int err;
+
+	err = zenpower_chardev_init();
+	if (err)
+		return err;
+
+	zenpower_debugfs_root = debugfs_create_dir("zenpower", NULL);
+
+	/* Without hotplug tracking each node keeps the RAPL CPU picked at probe */
+	err = zenpower_rapl_cpuhp_init();
+	if (err)
+		pr_info("zenpower: RAPL CPU hotplug tracking unavailable (%d)\n", err);
+
+	err = pci_register_driver(&zenpower_driver);
+	if (err) {
+		zenpower_sampler_exit();
+		zenpower_rapl_cpuhp_exit();
+		debugfs_remove_recursive(zenpower_debugfs_root);
+		zenpower_chardev_exit();
+		return err;
+	}
+
+	/* Aggregates span the nodes probed above */
+	err = zenpower_package_init();
+	if (err)
+		pr_info("zenpower: aggregate devices unavailable (%d)\n", err);
+
+	return 0;
+}
+
+static void __exit zenpower_exit(void)
+{
+	zenpower_package_exit();
+	pci_unregister_driver(&zenpower_driver);
+	zenpower_sampler_exit();
+	zenpower_rapl_cpuhp_exit();
+	debugfs_remove_recursive(zenpower_debugfs_root);
+	zenpower_chardev_exit();
+}
+
+module_init(zenpower_init);
+module_exit(zenpower_exit);
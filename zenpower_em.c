@@ -0,0 +1,493 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - Energy Model feed
+ *
+ * Builds a measured power-versus-frequency table per CCD and hands it to
+ * the kernel Energy Model, so energy-aware scheduling and the other EM users
+ * work from real costs instead of static estimates. Opt-in with em_feed=1;
+ * needs sample_interval_ms, the CCD map and the RAPL core energy MSR.
+ *
+ * Every ZEN_EM_PERIOD_MS, the sampler reads the per-core energy counter and
+ * APERF/MPERF of one thread per core of the mapped CCDs, in one IPI round.
+ * For every core busy at least ZEN_EM_MIN_BUSY of the period, the core power
+ * scaled to full activity is filed under the perf state nearest to its
+ * effective frequency (TSC kHz * dAPERF / dMPERF) and averaged per CCD.
+ *
+ * The feed only updates performance domains that the cpufreq driver already
+ * registered and that lie within one CCD; it registers none, as the EM can
+ * not unregister CPU domains. The perf states of a CCD are the union of the
+ * frequencies of its domains. Every ZEN_EM_PUSH_PERIODS periods with new
+ * data, each domain keeps its frequencies and gets the CCD's measured power
+ * at each of them. The original power values are saved per domain and put
+ * back on unload.
+ *
+ * States with too few samples are extrapolated from the nearest measured
+ * state with P ~ f^3, and power never decreases with frequency. The tables
+ * are printed by the debugfs file zenpower/<node>/em.
+ *
+ * EAS only consults the EM on systems with asymmetric CPU capacity; on
+ * others the tables serve the remaining EM users, such as thermal and DTPM.
+ * Built on kernels 6.9+ with CONFIG_ENERGY_MODEL.
+ */
+
+#include "zenpower.h"
+
+#ifdef ZENPOWER_EM
+
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/energy_model.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/topology.h>
+#include <asm/tsc.h>
+
+static bool em_feed;
+module_param(em_feed, bool, 0444);
+MODULE_PARM_DESC(em_feed, "Feed measured per-CCD power into the kernel Energy Model (default 0)");
+
+#define ZEN_EM_PERIOD_MS        1000
+#define ZEN_EM_PUSH_PERIODS     10
+#define ZEN_EM_MAX_STATES       32
+#define ZEN_EM_MIN_SAMPLES      8
+#define ZEN_EM_MIN_BUSY         500     /* permille of the period */
+
+/* Performance domain of a CCD, named by its first CPU */
+struct zenpower_em_pd {
+	int cpu;
+	bool updated;                           /* orig_power is to be put back */
+	unsigned int nr_states;
+	unsigned long orig_power[ZEN_EM_MAX_STATES];
+};
+
+struct zenpower_em_ccd {
+	unsigned int nr_states;
+	unsigned long freq[ZEN_EM_MAX_STATES];  /* kHz, ascending */
+	u64 power[ZEN_EM_MAX_STATES];           /* uW per CPU at full activity */
+	u32 samples[ZEN_EM_MAX_STATES];
+	bool dirty;
+
+	int nr_pds;
+	struct zenpower_em_pd *pds;
+};
+
+struct zenpower_em {
+	struct zenpower_data *data;
+	struct zenpower_core_sample __percpu *snap[2];
+	int cur;
+	cpumask_var_t cores;            /* one thread per core of the mapped CCDs */
+	ktime_t last;
+	unsigned int periods;
+	struct zenpower_em_ccd ccd[8];
+};
+
+/* Serializes the tables and the domain updates */
+static DEFINE_MUTEX(zenpower_em_lock);
+
+static int zenpower_em_cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Index of the perf state at @freq, or -1 */
+static int zenpower_em_state(const struct zenpower_em_ccd *ccd, unsigned long freq)
+{
+	unsigned int i;
+
+	for (i = 0; i < ccd->nr_states; i++) {
+		if (ccd->freq[i] == freq)
+			return i;
+	}
+
+	return -1;
+}
+
+/* Add the domain of @cpu to @ccd, with its frequencies */
+static int zenpower_em_add_pd(struct zenpower_em_ccd *ccd, int cpu)
+{
+	struct em_perf_domain *pd = em_cpu_get(cpu);
+	struct em_perf_state *ps;
+	unsigned int i, n = ccd->nr_states;
+	int err = 0;
+
+	if (!pd)
+		return -ENODEV;
+	if (pd->nr_perf_states > ZEN_EM_MAX_STATES)
+		return -E2BIG;
+
+	rcu_read_lock();
+	ps = em_perf_state_from_pd(pd);
+	for (i = 0; i < pd->nr_perf_states && !err; i++) {
+		if (zenpower_em_state(ccd, ps[i].frequency) >= 0)
+			continue;
+		if (n == ZEN_EM_MAX_STATES)
+			err = -E2BIG;
+		else
+			ccd->freq[n++] = ps[i].frequency;
+	}
+	rcu_read_unlock();
+	if (err)
+		return err;
+
+	sort(ccd->freq, n, sizeof(*ccd->freq), zenpower_em_cmp_ulong, NULL);
+	ccd->nr_states = n;
+	ccd->pds[ccd->nr_pds++].cpu = cpu;
+
+	return 0;
+}
+
+static unsigned int zenpower_em_nearest(const struct zenpower_em_ccd *ccd,
+					unsigned long freq)
+{
+	unsigned int i, best = 0;
+
+	for (i = 1; i < ccd->nr_states; i++) {
+		if (abs_diff(ccd->freq[i], freq) < abs_diff(ccd->freq[best], freq))
+			best = i;
+	}
+
+	return best;
+}
+
+/* File the last period of every busy core of @ccd under its perf state */
+static void zenpower_em_account(struct zenpower_em *em, int id, u64 dt)
+{
+	struct zenpower_em_ccd *ccd = &em->ccd[id];
+	const struct zenpower_core_sample *p, *c;
+	u64 ref, busy, power, freq;
+	unsigned int state;
+	int cpu;
+
+	/* MPERF counts at the TSC rate while the core is in C0 */
+	ref = div_u64((u64)tsc_khz * dt, NSEC_PER_MSEC);
+	if (!ref)
+		return;
+
+	for_each_cpu_and(cpu, zenpower_ccd_cpus(em->data, id), em->cores) {
+		p = per_cpu_ptr(em->snap[em->cur ^ 1], cpu);
+		c = per_cpu_ptr(em->snap[em->cur], cpu);
+		if (p->err || c->err || c->mperf <= p->mperf)
+			continue;
+
+		busy = min_t(u64, div64_u64((c->mperf - p->mperf) * 1000, ref), 1000);
+		if (busy < ZEN_EM_MIN_BUSY)
+			continue;
+
+		freq = div64_u64((u64)tsc_khz * (c->aperf - p->aperf), c->mperf - p->mperf);
+		power = zenpower_rapl_counts_to_uw(em->data, (u32)(c->energy - p->energy), dt);
+		power = div64_u64(power * 1000, busy);
+
+		state = zenpower_em_nearest(ccd, freq);
+		if (ccd->samples[state])
+			ccd->power[state] = (ccd->power[state] * 7 + power) / 8;
+		else
+			ccd->power[state] = power;
+		if (ccd->samples[state] < U32_MAX)
+			ccd->samples[state]++;
+		ccd->dirty = true;
+	}
+}
+
+/* Measured table with extrapolated gaps, non-decreasing; false if nothing measured */
+static bool zenpower_em_table(const struct zenpower_em_ccd *ccd, unsigned long *power)
+{
+	unsigned int i, j, near;
+	u64 fi, fn;
+	bool any = false;
+
+	for (i = 0; i < ccd->nr_states; i++)
+		any |= ccd->samples[i] >= ZEN_EM_MIN_SAMPLES;
+	if (!any)
+		return false;
+
+	for (i = 0; i < ccd->nr_states; i++) {
+		near = i;
+		for (j = 0; j < ccd->nr_states; j++) {
+			if (ccd->samples[j] >= ZEN_EM_MIN_SAMPLES &&
+			    (ccd->samples[near] < ZEN_EM_MIN_SAMPLES ||
+			     abs_diff(i, j) < abs_diff(i, near)))
+				near = j;
+		}
+
+		/* Dynamic power ~ f * V^2, with V roughly following f; MHz keeps f^3 in range */
+		fi = ccd->freq[i] / 1000;
+		fn = ccd->freq[near] / 1000;
+		power[i] = near == i || !fn ? ccd->power[i] :
+			   mul_u64_u64_div_u64(ccd->power[near], fi * fi * fi, fn * fn * fn);
+		power[i] = clamp_t(u64, power[i], 1, EM_MAX_POWER);
+		if (i && power[i] < power[i - 1])
+			power[i] = power[i - 1];
+	}
+
+	return true;
+}
+
+/*
+ * Set the power of @d from the table of @ccd, saving the original values
+ * first. With a NULL @ccd, put the original values back.
+ */
+static int zenpower_em_update(struct zenpower_em_pd *d, const struct zenpower_em_ccd *ccd,
+			      const unsigned long *power)
+{
+	struct device *dev = get_cpu_device(d->cpu);
+	struct em_perf_domain *pd = em_cpu_get(d->cpu);
+	struct em_perf_table *table;
+	unsigned int i, n;
+	int state, err = 0;
+
+	if (!dev || !pd)
+		return -ENODEV;
+	n = pd->nr_perf_states;
+	if (n > ZEN_EM_MAX_STATES || (!ccd && n != d->nr_states))
+		return -EINVAL;
+
+	table = em_table_alloc(pd);
+	if (!table)
+		return -ENOMEM;
+
+	rcu_read_lock();
+	memcpy(table->state, em_perf_state_from_pd(pd), n * sizeof(*table->state));
+	rcu_read_unlock();
+
+	for (i = 0; i < n; i++) {
+		if (!ccd) {
+			table->state[i].power = d->orig_power[i];
+			continue;
+		}
+
+		state = zenpower_em_state(ccd, table->state[i].frequency);
+		if (state < 0) {
+			err = -EINVAL;
+			goto out;
+		}
+		if (!d->updated)
+			d->orig_power[i] = table->state[i].power;
+		table->state[i].power = power[state];
+	}
+
+	err = em_dev_compute_costs(dev, table->state, n);
+	if (!err)
+		err = em_dev_update_perf_domain(dev, table);
+	if (!err && ccd && !d->updated) {
+		d->nr_states = n;
+		d->updated = true;
+	}
+out:
+	em_table_free(table);
+	return err;
+}
+
+/* Push the table of @ccd to each of its domains */
+static void zenpower_em_push(struct zenpower_em *em, int id)
+{
+	struct zenpower_em_ccd *ccd = &em->ccd[id];
+	unsigned long power[ZEN_EM_MAX_STATES];
+	int i, err;
+
+	if (!zenpower_em_table(ccd, power))
+		return;
+	ccd->dirty = false;
+
+	for (i = 0; i < ccd->nr_pds; i++) {
+		err = zenpower_em_update(&ccd->pds[i], ccd, power);
+		if (err)
+			dev_dbg(&em->data->pdev->dev, "EM update of CPU%d failed (%d)\n",
+				ccd->pds[i].cpu, err);
+	}
+}
+
+/* Called by the sampler on every pass; measures once per ZEN_EM_PERIOD_MS */
+void zenpower_em_sample(struct zenpower_data *data)
+{
+	struct zenpower_em *em = data->em;
+	ktime_t now = ktime_get();
+	struct zenpower_core_sample *c;
+	bool push;
+	int cpu, i;
+
+	if (em->last && ktime_ms_delta(now, em->last) < ZEN_EM_PERIOD_MS)
+		return;
+
+	mutex_lock(&zenpower_em_lock);
+
+	em->cur ^= 1;
+	for_each_cpu(cpu, em->cores) {
+		c = per_cpu_ptr(em->snap[em->cur], cpu);
+		c->err = -ENODEV;
+	}
+	zenpower_rapl_read_cores(em->cores, em->snap[em->cur]);
+
+	push = ++em->periods >= ZEN_EM_PUSH_PERIODS;
+	if (push)
+		em->periods = 0;
+
+	for (i = 0; i < 8; i++) {
+		if (!em->ccd[i].nr_states)
+			continue;
+		if (em->last)
+			zenpower_em_account(em, i, ktime_to_ns(ktime_sub(now, em->last)));
+		if (push && em->ccd[i].dirty)
+			zenpower_em_push(em, i);
+	}
+	em->last = now;
+
+	mutex_unlock(&zenpower_em_lock);
+}
+
+static int zenpower_em_show(struct seq_file *m, void *v)
+{
+	struct zenpower_em *em = m->private;
+	const struct zenpower_em_ccd *ccd;
+	unsigned long power[ZEN_EM_MAX_STATES];
+	unsigned int i;
+	int id;
+
+	mutex_lock(&zenpower_em_lock);
+	for (id = 0; id < 8; id++) {
+		ccd = &em->ccd[id];
+		if (!ccd->nr_states)
+			continue;
+
+		seq_printf(m, "# ccd %d cpus %*pbl domains %d\n", id + 1,
+			   cpumask_pr_args(zenpower_ccd_cpus(em->data, id)), ccd->nr_pds);
+		seq_puts(m, "# freq_khz power_uw samples table_uw\n");
+		if (!zenpower_em_table(ccd, power))
+			memset(power, 0, sizeof(power));
+		for (i = 0; i < ccd->nr_states; i++)
+			seq_printf(m, "%lu %llu %u %lu\n", ccd->freq[i], ccd->power[i],
+				   ccd->samples[i], power[i]);
+	}
+	mutex_unlock(&zenpower_em_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(zenpower_em);
+
+/* Put back the original power of updated domains, then free */
+static void zenpower_em_release(void *arg)
+{
+	struct zenpower_em *em = arg;
+	struct zenpower_em_ccd *ccd;
+	int id, i;
+
+	mutex_lock(&zenpower_em_lock);
+	for (id = 0; id < 8; id++) {
+		ccd = &em->ccd[id];
+		for (i = 0; i < ccd->nr_pds; i++) {
+			if (ccd->pds[i].updated)
+				zenpower_em_update(&ccd->pds[i], NULL, NULL);
+		}
+		kfree(ccd->pds);
+	}
+	mutex_unlock(&zenpower_em_lock);
+
+	free_cpumask_var(em->cores);
+	free_percpu(em->snap[0]);
+	free_percpu(em->snap[1]);
+	kfree(em);
+}
+
+static void zenpower_em_remove(void *arg)
+{
+	debugfs_remove(arg);
+}
+
+/* Set up the feed. Must run after the CCD map is built. */
+int zenpower_em_init(struct zenpower_data *data, struct device *dev)
+{
+	struct zenpower_em *em;
+	const struct cpumask *cpus;
+	struct em_perf_domain *pd;
+	int id, cpu, err, nr = 0;
+
+	if (!em_feed || !data->ccd_map)
+		return 0;
+	if (!data->rapl_core_energy || !tsc_khz)
+		return -ENODEV;
+
+	em = kzalloc_node(sizeof(*em), GFP_KERNEL, data->numa_node);
+	if (!em)
+		return -ENOMEM;
+	em->data = data;
+	err = devm_add_action_or_reset(dev, zenpower_em_release, em);
+	if (err)
+		return err;
+
+	em->snap[0] = alloc_percpu(struct zenpower_core_sample);
+	em->snap[1] = alloc_percpu(struct zenpower_core_sample);
+	if (!em->snap[0] || !em->snap[1] ||
+	    !zalloc_cpumask_var(&em->cores, GFP_KERNEL))
+		return -ENOMEM;
+
+	cpus_read_lock();
+	for (id = 0; id < 8; id++) {
+		struct zenpower_em_ccd *ccd = &em->ccd[id];
+
+		if (!data->ccd_visible[id])
+			continue;
+		cpus = zenpower_ccd_cpus(data, id);
+		if (cpumask_empty(cpus))
+			continue;
+
+		ccd->pds = kcalloc(cpumask_weight(cpus), sizeof(*ccd->pds), GFP_KERNEL);
+		if (!ccd->pds) {
+			cpus_read_unlock();
+			return -ENOMEM;
+		}
+
+		/* Existing domains within the CCD, each added once */
+		for_each_cpu(cpu, cpus) {
+			pd = em_cpu_get(cpu);
+			if (!pd || cpu != cpumask_first(em_span_cpus(pd)))
+				continue;
+			if (!cpumask_subset(em_span_cpus(pd), cpus)) {
+				dev_dbg(dev, "EM domain of CPU%d spans CCDs, skipped\n", cpu);
+				continue;
+			}
+			err = zenpower_em_add_pd(ccd, cpu);
+			if (err)
+				dev_dbg(dev, "EM domain of CPU%d skipped (%d)\n", cpu, err);
+		}
+		if (!ccd->nr_pds) {
+			ccd->nr_states = 0;
+			continue;
+		}
+
+		/* The core energy counter is per core: read it on one thread */
+		for_each_cpu(cpu, cpus) {
+			if (cpu == cpumask_first(topology_sibling_cpumask(cpu)))
+				cpumask_set_cpu(cpu, em->cores);
+		}
+		nr++;
+	}
+	cpus_read_unlock();
+
+	if (!nr)
+		return -ENODEV;
+
+	if (data->debugfs) {
+		struct dentry *file;
+
+		file = debugfs_create_file("em", 0400, data->debugfs, em,
+					   &zenpower_em_fops);
+		if (!IS_ERR(file)) {
+			err = devm_add_action_or_reset(dev, zenpower_em_remove, file);
+			if (err)
+				return err;
+		}
+	}
+
+	data->em = em;
+	dev_info(dev, "Energy Model feed for %d CCDs\n", nr);
+
+	return 0;
+}
+
+#endif /* ZENPOWER_EM */
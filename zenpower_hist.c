@@ -0,0 +1,319 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - Residency histograms
+ *
+ * Every sampler pass records the current value of each channel. The value
+ * is held until the next pass, whose bucket is then charged with the real
+ * time between the two passes, so residency stays right when the tick runs
+ * late. One read gives a full residency distribution without sampling from
+ * userspace.
+ *
+ *   vid_core, vid_soc     one bucket per SVI2 VID code (6.25 mV steps)
+ *   idd_core, idd_soc     one bucket per SVI2 IDD code
+ *   tctl, tccd1..8        1 °C buckets, 0-127 °C
+ *   rapl_package          1 W buckets, 0-511 W
+ *
+ * Values outside the range are counted in the first or last bucket.
+ * Files live in /sys/kernel/debug/zenpower/<node>/hist/. Reading a file
+ * prints its non-empty buckets in ms. Writing to it clears that histogram, and
+ * writing to "reset" clears all of them.
+ *
+ * Memory: 21 KiB of counters per node, allocated only with
+ * sample_interval_ms set, debugfs available and hist=1.
+ */
+
+#include "zenpower.h"
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+
+static bool hist = true;
+module_param(hist, bool, 0444);
+MODULE_PARM_DESC(hist, "Keep residency histograms per node in debugfs (default 1)");
+
+enum zenpower_hist_id {
+	ZEN_HIST_VID_CORE,
+	ZEN_HIST_VID_SOC,
+	ZEN_HIST_IDD_CORE,
+	ZEN_HIST_IDD_SOC,
+	ZEN_HIST_TCTL,
+	ZEN_HIST_TCCD1,
+	ZEN_HIST_RAPL = ZEN_HIST_TCCD1 + 8,
+	ZEN_HIST_NR
+};
+
+enum zenpower_hist_kind {
+	ZEN_HIST_KIND_VID,
+	ZEN_HIST_KIND_IDD,
+	ZEN_HIST_KIND_TEMP,
+	ZEN_HIST_KIND_POWER,
+};
+
+#define ZEN_HIST_SVI2_BUCKETS   256     /* 8-bit VID/IDD codes */
+#define ZEN_HIST_TEMP_BUCKETS   128     /* °C */
+#define ZEN_HIST_POWER_BUCKETS  512     /* W */
+
+static const struct {
+	const char *name;
+	enum zenpower_hist_kind kind;
+	unsigned int buckets;
+} zenpower_hist_desc[ZEN_HIST_NR] = {
+	[ZEN_HIST_VID_CORE] = { "vid_core", ZEN_HIST_KIND_VID, ZEN_HIST_SVI2_BUCKETS },
+	[ZEN_HIST_VID_SOC] = { "vid_soc", ZEN_HIST_KIND_VID, ZEN_HIST_SVI2_BUCKETS },
+	[ZEN_HIST_IDD_CORE] = { "idd_core", ZEN_HIST_KIND_IDD, ZEN_HIST_SVI2_BUCKETS },
+	[ZEN_HIST_IDD_SOC] = { "idd_soc", ZEN_HIST_KIND_IDD, ZEN_HIST_SVI2_BUCKETS },
+	[ZEN_HIST_TCTL] = { "tctl", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_TCCD1 + 0] = { "tccd1", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_TCCD1 + 1] = { "tccd2", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_TCCD1 + 2] = { "tccd3", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_TCCD1 + 3] = { "tccd4", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_TCCD1 + 4] = { "tccd5", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_TCCD1 + 5] = { "tccd6", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_TCCD1 + 6] = { "tccd7", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_TCCD1 + 7] = { "tccd8", ZEN_HIST_KIND_TEMP, ZEN_HIST_TEMP_BUCKETS },
+	[ZEN_HIST_RAPL] = { "rapl_package", ZEN_HIST_KIND_POWER, ZEN_HIST_POWER_BUCKETS },
+};
+
+/* debugfs file private data */
+struct zenpower_hist_file {
+	struct zenpower_data *data;
+	enum zenpower_hist_id id;
+};
+
+struct zenpower_hist {
+	u64 *bucket[ZEN_HIST_NR];   /* residency in ns */
+	u64 samples[ZEN_HIST_NR];
+	s16 held[ZEN_HIST_NR];      /* bucket of the last pass, -1 if none */
+	ktime_t last;
+	struct zenpower_hist_file file[ZEN_HIST_NR];
+	u64 counts[];
+};
+
+static void zenpower_hist_add(struct zenpower_hist *h, enum zenpower_hist_id id,
+			      long index)
+{
+	h->held[id] = clamp_t(long, index, 0, zenpower_hist_desc[id].buckets - 1);
+	h->samples[id]++;
+}
+
+/* Fold one sampler pass into the histograms. Caller holds sample_lock. */
+void zenpower_hist_sample(struct zenpower_data *data,
+			  const struct zenpower_sample *s)
+{
+	struct zenpower_hist *h = data->hist;
+	u64 delta = ktime_to_ns(ktime_sub(s->time, h->last));
+	int i;
+
+	/* Charge the values of the previous pass with the time since */
+	for (i = 0; i < ZEN_HIST_NR; i++) {
+		if (h->held[i] >= 0)
+			h->bucket[i][h->held[i]] += delta;
+		h->held[i] = -1;
+	}
+	h->last = s->time;
+
+	if (s->has_svi2) {
+		for (i = 0; i < 2; i++) {
+			if (!(s->svi2_valid & BIT(i)))
+				continue;
+			zenpower_hist_add(h, ZEN_HIST_VID_CORE + i,
+					  (s->svi2_plane[i] >> 16) & 0xff);
+			zenpower_hist_add(h, ZEN_HIST_IDD_CORE + i,
+					  s->svi2_plane[i] & 0xff);
+		}
+	}
+
+	if (s->has_temps) {
+		if (s->has_tctl)
+			zenpower_hist_add(h, ZEN_HIST_TCTL, s->tctl / 1000);
+		for (i = 0; i < 8; i++) {
+			if (s->tccd_valid & BIT(i))
+				zenpower_hist_add(h, ZEN_HIST_TCCD1 + i, s->tccd[i] / 1000);
+		}
+	}
+
+	if (s->has_rapl_power)
+		zenpower_hist_add(h, ZEN_HIST_RAPL, div_u64(s->rapl_power, 1000000));
+}
+
+/* Bucket @i of histogram @id as the value it stands for, and its residency */
+static void zenpower_hist_print_bucket(struct seq_file *m, struct zenpower_data *data,
+				       enum zenpower_hist_id id, unsigned int i,
+				       u64 ns)
+{
+	bool soc = id == ZEN_HIST_VID_SOC || id == ZEN_HIST_IDD_SOC;
+	u64 count = div_u64(ns, NSEC_PER_MSEC);
+
+	switch (zenpower_hist_desc[id].kind) {
+	case ZEN_HIST_KIND_VID:
+		seq_printf(m, "%3u %5u mV %llu\n", i,
+			   zenpower_svi2_plane_to_vcc(i << 16), count);
+		break;
+	case ZEN_HIST_KIND_IDD:
+		seq_printf(m, "%3u %6u mA %llu\n", i,
+			   zenpower_svi2_get_current(data, i, soc), count);
+		break;
+	case ZEN_HIST_KIND_TEMP:
+		seq_printf(m, "%3u C %llu\n", i, count);
+		break;
+	case ZEN_HIST_KIND_POWER:
+		seq_printf(m, "%3u W %llu\n", i, count);
+		break;
+	}
+}
+
+static int zenpower_hist_show(struct seq_file *m, void *v)
+{
+	struct zenpower_hist_file *f = m->private;
+	struct zenpower_data *data = f->data;
+	unsigned int i, n = zenpower_hist_desc[f->id].buckets;
+	u64 *copy, samples, total = 0;
+
+	copy = kmalloc_array(n, sizeof(*copy), GFP_KERNEL);
+	if (!copy)
+		return -ENOMEM;
+
+	spin_lock(&data->sample_lock);
+	memcpy(copy, data->hist->bucket[f->id], n * sizeof(*copy));
+	samples = data->hist->samples[f->id];
+	spin_unlock(&data->sample_lock);
+
+	for (i = 0; i < n; i++)
+		total += copy[i];
+
+	seq_printf(m, "# samples %llu time_ms %llu\n", samples,
+		   div_u64(total, NSEC_PER_MSEC));
+	for (i = 0; i < n; i++) {
+		if (copy[i])
+			zenpower_hist_print_bucket(m, data, f->id, i, copy[i]);
+	}
+
+	kfree(copy);
+	return 0;
+}
+
+static void zenpower_hist_clear(struct zenpower_data *data, enum zenpower_hist_id id)
+{
+	memset(data->hist->bucket[id], 0,
+	       zenpower_hist_desc[id].buckets * sizeof(u64));
+	data->hist->samples[id] = 0;
+}
+
+static int zenpower_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zenpower_hist_show, inode->i_private);
+}
+
+static ssize_t zenpower_hist_write(struct file *file, const char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct zenpower_hist_file *f = m->private;
+
+	spin_lock(&f->data->sample_lock);
+	zenpower_hist_clear(f->data, f->id);
+	spin_unlock(&f->data->sample_lock);
+
+	return count;
+}
+
+static const struct file_operations zenpower_hist_fops = {
+	.owner = THIS_MODULE,
+	.open = zenpower_hist_open,
+	.read = seq_read,
+	.write = zenpower_hist_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static ssize_t zenpower_hist_reset_write(struct file *file, const char __user *buf,
+					 size_t count, loff_t *ppos)
+{
+	struct zenpower_data *data = file->private_data;
+	int i;
+
+	spin_lock(&data->sample_lock);
+	for (i = 0; i < ZEN_HIST_NR; i++)
+		zenpower_hist_clear(data, i);
+	spin_unlock(&data->sample_lock);
+
+	return count;
+}
+
+static const struct file_operations zenpower_hist_reset_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = zenpower_hist_reset_write,
+};
+
+static bool zenpower_hist_present(struct zenpower_data *data, enum zenpower_hist_id id)
+{
+	switch (id) {
+	case ZEN_HIST_VID_CORE:
+	case ZEN_HIST_IDD_CORE:
+		return data->svi2_energy && data->svi_core_addr;
+	case ZEN_HIST_VID_SOC:
+	case ZEN_HIST_IDD_SOC:
+		return data->svi2_energy && data->svi_soc_addr;
+	case ZEN_HIST_TCTL:
+		return true;
+	case ZEN_HIST_RAPL:
+		return data->rapl_initialized;
+	default:
+		return data->ccd_visible[id - ZEN_HIST_TCCD1];
+	}
+}
+
+static void zenpower_hist_remove(void *arg)
+{
+	debugfs_remove_recursive(arg);
+}
+
+/* Allocate the histograms and their debugfs files. Called by the sampler. */
+int zenpower_hist_init(struct zenpower_data *data, struct device *dev)
+{
+	struct zenpower_hist *h;
+	struct dentry *dir;
+	size_t total = 0;
+	int i, err;
+
+	if (!hist || !data->debugfs)
+		return 0;
+
+	for (i = 0; i < ZEN_HIST_NR; i++)
+		total += zenpower_hist_desc[i].buckets;
+
+	h = zenpower_devm_kzalloc(data, dev, struct_size(h, counts, total));
+	if (!h)
+		return -ENOMEM;
+
+	total = 0;
+	for (i = 0; i < ZEN_HIST_NR; i++) {
+		h->bucket[i] = &h->counts[total];
+		h->held[i] = -1;
+		total += zenpower_hist_desc[i].buckets;
+	}
+
+	/* Files go away before the counters are freed */
+	dir = debugfs_create_dir("hist", data->debugfs);
+	if (IS_ERR(dir))
+		return PTR_ERR(dir);
+	err = devm_add_action_or_reset(dev, zenpower_hist_remove, dir);
+	if (err)
+		return err;
+
+	for (i = 0; i < ZEN_HIST_NR; i++) {
+		if (!zenpower_hist_present(data, i))
+			continue;
+		h->file[i].data = data;
+		h->file[i].id = i;
+		debugfs_create_file(zenpower_hist_desc[i].name, 0600, dir,
+				    &h->file[i], &zenpower_hist_fops);
+	}
+	debugfs_create_file("reset", 0200, dir, data, &zenpower_hist_reset_fops);
+
+	data->hist = h;
+	return 0;
+}
@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - Tiered long-horizon history
+ *
+ * Keeps the recent thermal and power history of a node in kernel memory, so
+ * that it survives an outage of the metrics agent. Every sampler pass is
+ * folded into the open bucket of the finest tier; a closed bucket is stored
+ * in that tier's ring and folded into the next tier:
+ *
+ *   tier 0    1 s buckets x 600     10 minutes
+ *   tier 1    1 min buckets x 1440  24 hours
+ *   tier 2    1 h buckets x 720     30 days
+ *
+ * Each bucket holds min/avg/max of Tctl, the hottest CCD, SVI2 core and SoC
+ * power and RAPL package power, over the sampler passes it covers. Averages
+ * of coarser tiers are weighted by sample count. Buckets are aligned to
+ * CLOCK_MONOTONIC multiples of their period; periods without sampling leave
+ * no bucket, so gaps show in the start times. Open buckets are not exported.
+ *
+ * The binary file zenpower/<node>/history is described in zenpower_uapi.h.
+ *
+ * Memory: 2760 buckets of 80 bytes, about 216 KiB per node, allocated
+ * only with sample_interval_ms set, history=1 and debugfs available.
+ */
+
+#include "zenpower.h"
+#include "zenpower_uapi.h"
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+
+static bool history = true;
+module_param(history, bool, 0444);
+MODULE_PARM_DESC(history, "Keep a tiered thermal/power history per node in debugfs (default 1)");
+
+#define ZEN_HISTORY_TIERS       ZENPOWER_HISTORY_TIERS
+#define ZEN_HISTORY_METRICS     ZENPOWER_HISTORY_METRICS
+
+static const struct {
+	u32 period_s;
+	u32 nr_buckets;
+} zenpower_history_tiers[ZEN_HISTORY_TIERS] = {
+	{ 1, 600 },
+	{ 60, 1440 },
+	{ 3600, 720 },
+};
+
+/* Open bucket of a tier */
+struct zenpower_history_acc {
+	u64 start;
+	u32 samples;
+	u32 valid;
+	s32 min[ZEN_HISTORY_METRICS];
+	s32 max[ZEN_HISTORY_METRICS];
+	s64 sum[ZEN_HISTORY_METRICS];
+	u32 count[ZEN_HISTORY_METRICS];
+};
+
+struct zenpower_history {
+	struct zenpower_history_acc acc[ZEN_HISTORY_TIERS];
+	u32 head[ZEN_HISTORY_TIERS];    /* next slot to write */
+	u32 used[ZEN_HISTORY_TIERS];
+	struct zenpower_history_bucket *ring[ZEN_HISTORY_TIERS];
+	struct zenpower_history_bucket buckets[];
+};
+
+static void zenpower_history_merge(struct zenpower_history_acc *acc,
+				   const struct zenpower_history_acc *in)
+{
+	int i;
+
+	acc->samples += in->samples;
+	for (i = 0; i < ZEN_HISTORY_METRICS; i++) {
+		if (!(in->valid & BIT(i)))
+			continue;
+		if (acc->valid & BIT(i)) {
+			acc->min[i] = min(acc->min[i], in->min[i]);
+			acc->max[i] = max(acc->max[i], in->max[i]);
+		} else {
+			acc->min[i] = in->min[i];
+			acc->max[i] = in->max[i];
+		}
+		acc->sum[i] += in->sum[i];
+		acc->count[i] += in->count[i];
+	}
+	acc->valid |= in->valid;
+}
+
+static void zenpower_history_add(struct zenpower_history *h, int tier,
+				 u64 time, const struct zenpower_history_acc *in);
+
+/* Store the open bucket of @tier in its ring and fold it into the next tier */
+static void zenpower_history_close(struct zenpower_history *h, int tier)
+{
+	struct zenpower_history_acc *acc = &h->acc[tier];
+	struct zenpower_history_bucket *b = &h->ring[tier][h->head[tier]];
+	int i;
+
+	memset(b, 0, sizeof(*b));
+	b->start_ns = acc->start;
+	b->samples = acc->samples;
+	b->valid = acc->valid;
+	for (i = 0; i < ZEN_HISTORY_METRICS; i++) {
+		if (!(acc->valid & BIT(i)))
+			continue;
+		b->stat[i].min = acc->min[i];
+		b->stat[i].avg = div_s64(acc->sum[i], acc->count[i]);
+		b->stat[i].max = acc->max[i];
+	}
+
+	h->head[tier] = (h->head[tier] + 1) % zenpower_history_tiers[tier].nr_buckets;
+	if (h->used[tier] < zenpower_history_tiers[tier].nr_buckets)
+		h->used[tier]++;
+
+	if (tier + 1 < ZEN_HISTORY_TIERS)
+		zenpower_history_add(h, tier + 1, acc->start, acc);
+
+	memset(acc, 0, sizeof(*acc));
+}
+
+/* Fold @in, starting at @time, into the open bucket of @tier */
+static void zenpower_history_add(struct zenpower_history *h, int tier,
+				 u64 time, const struct zenpower_history_acc *in)
+{
+	struct zenpower_history_acc *acc = &h->acc[tier];
+	u64 period = (u64)zenpower_history_tiers[tier].period_s * NSEC_PER_SEC;
+	u64 start = div64_u64(time, period) * period;
+
+	if (acc->samples && start != acc->start)
+		zenpower_history_close(h, tier);
+	if (!acc->samples)
+		acc->start = start;
+
+	zenpower_history_merge(acc, in);
+}
+
+static void zenpower_history_value(struct zenpower_history_acc *one, int i, s64 v)
+{
+	one->min[i] = one->max[i] = v;
+	one->sum[i] = v;
+	one->count[i] = 1;
+	one->valid |= BIT(i);
+}
+
+/* Fold one sampler pass into the history. Caller holds sample_lock. */
+void zenpower_history_sample(struct zenpower_data *data,
+			     const struct zenpower_sample *s)
+{
+	struct zenpower_history_acc one = { .samples = 1 };
+
+	if (s->has_temps) {
+		if (s->has_tctl)
+			zenpower_history_value(&one, ZENPOWER_HISTORY_TCTL, s->tctl);
+		if (s->tccd_max)
+			zenpower_history_value(&one, ZENPOWER_HISTORY_TCCD_MAX, s->tccd_max);
+	}
+	if (s->has_svi2) {
+		if (s->svi2_valid & BIT(0))
+			zenpower_history_value(&one, ZENPOWER_HISTORY_SVI2_CORE,
+					       s->svi2_power[0] / 1000);
+		if (s->svi2_valid & BIT(1))
+			zenpower_history_value(&one, ZENPOWER_HISTORY_SVI2_SOC,
+					       s->svi2_power[1] / 1000);
+	}
+	if (s->has_rapl_power)
+		zenpower_history_value(&one, ZENPOWER_HISTORY_RAPL_PACKAGE,
+				       div_u64(s->rapl_power, 1000));
+
+	zenpower_history_add(data->history, 0, ktime_to_ns(s->time), &one);
+}
+
+/* Snapshot taken at open, so a read never holds sample_lock for long */
+struct zenpower_history_snapshot {
+	size_t size;
+	char buf[];
+};
+
+static int zenpower_history_open(struct inode *inode, struct file *file)
+{
+	struct zenpower_data *data = inode->i_private;
+	struct zenpower_history *h = data->history;
+	struct zenpower_history_snapshot *snap;
+	struct zenpower_history_header *hdr;
+	struct zenpower_history_bucket *out;
+	size_t size = sizeof(*hdr);
+	int t, i;
+
+	for (t = 0; t < ZEN_HISTORY_TIERS; t++)
+		size += zenpower_history_tiers[t].nr_buckets * sizeof(*out);
+
+	snap = kvzalloc(sizeof(*snap) + size, GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	hdr = (struct zenpower_history_header *)snap->buf;
+	hdr->magic = ZENPOWER_HISTORY_MAGIC;
+	hdr->version = ZENPOWER_HISTORY_VERSION;
+	hdr->nr_tiers = ZEN_HISTORY_TIERS;
+	hdr->nr_metrics = ZEN_HISTORY_METRICS;
+	hdr->realtime_offset_ns = ktime_get_real_ns() - ktime_get_ns();
+	out = (struct zenpower_history_bucket *)(hdr + 1);
+
+	spin_lock(&data->sample_lock);
+	for (t = 0; t < ZEN_HISTORY_TIERS; t++) {
+		u32 nr = zenpower_history_tiers[t].nr_buckets;
+		u32 first = (h->head[t] + nr - h->used[t]) % nr;
+
+		hdr->tiers[t].period_s = zenpower_history_tiers[t].period_s;
+		hdr->tiers[t].nr_buckets = nr;
+		hdr->tiers[t].nr_valid = h->used[t];
+		for (i = 0; i < h->used[t]; i++)
+			*out++ = h->ring[t][(first + i) % nr];
+	}
+	spin_unlock(&data->sample_lock);
+
+	snap->size = (char *)out - snap->buf;
+	file->private_data = snap;
+	return 0;
+}
+
+static ssize_t zenpower_history_read(struct file *file, char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct zenpower_history_snapshot *snap = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, snap->buf, snap->size);
+}
+
+static int zenpower_history_release(struct inode *inode, struct file *file)
+{
+	kvfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations zenpower_history_fops = {
+	.owner = THIS_MODULE,
+	.open = zenpower_history_open,
+	.read = zenpower_history_read,
+	.release = zenpower_history_release,
+	.llseek = default_llseek,
+};
+
+static void zenpower_history_free(void *arg)
+{
+	kvfree(arg);
+}
+
+static void zenpower_history_remove(void *arg)
+{
+	debugfs_remove(arg);
+}
+
+/* Allocate the rings and the debugfs file. Called by the sampler. */
+int zenpower_history_init(struct zenpower_data *data, struct device *dev)
+{
+	struct zenpower_history *h;
+	struct dentry *file;
+	size_t total = 0;
+	int t, err;
+
+	if (!history || !data->debugfs)
+		return 0;
+
+	for (t = 0; t < ZEN_HISTORY_TIERS; t++)
+		total += zenpower_history_tiers[t].nr_buckets;
+
+	h = kvzalloc_node(struct_size(h, buckets, total), GFP_KERNEL, data->numa_node);
+	if (!h)
+		return -ENOMEM;
+	err = devm_add_action_or_reset(dev, zenpower_history_free, h);
+	if (err)
+		return err;
+
+	total = 0;
+	for (t = 0; t < ZEN_HISTORY_TIERS; t++) {
+		h->ring[t] = &h->buckets[total];
+		total += zenpower_history_tiers[t].nr_buckets;
+	}
+
+	/* The file goes away before the rings are freed */
+	file = debugfs_create_file("history", 0400, data->debugfs, data,
+				   &zenpower_history_fops);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+	err = devm_add_action_or_reset(dev, zenpower_history_remove, file);
+	if (err)
+		return err;
+
+	data->history = h;
+	return 0;
+}
@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - IIO buffered streaming
+ *
+ * Registers one IIO device per node with the zenpower channels as scan
+ * elements, so long captures can use triggered buffers and the standard IIO
+ * tooling instead of one sysfs read per value:
+ *
+ *   in_temp0        Tctl                    m°C
+ *   in_temp1..8     Tccd1..8 (present CCDs) m°C
+ *   in_voltage0/1   SVI2 Core/SoC           mV
+ *   in_current0/1   SVI2 Core/SoC           mA
+ *   in_energy0      RAPL package            uJ (scale 0.000001 J), scan only
+ *   timestamp
+ *
+ * Enabled with iio=1. The driver ships no trigger: any works, and the
+ * intended one is the kernel's hrtimer trigger (iio-trig-hrtimer) created
+ * through configfs. Every trigger runs one scan in the threaded handler, which
+ * calls the same backend reads as hwmon and pushes a timestamped scan into
+ * the buffer's kfifo.
+ *
+ * Built when the kernel has CONFIG_IIO_TRIGGERED_BUFFER.
+ */
+
+#include "zenpower.h"
+
+#if IS_ENABLED(CONFIG_IIO_TRIGGERED_BUFFER)
+
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/trigger.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+#include <linux/module.h>
+#include <linux/version.h>
+
+static bool iio;
+module_param(iio, bool, 0444);
+MODULE_PARM_DESC(iio, "Register an IIO device per node for buffered capture (default 0)");
+
+/* Tctl, 8 Tccd, 2 voltages, 2 currents, energy, timestamp */
+#define ZEN_IIO_MAX_CHANNELS    15
+
+/* Channel sources, in iio_chan_spec.address */
+enum zenpower_iio_source {
+	ZEN_IIO_TCTL,
+	ZEN_IIO_TCCD,
+	ZEN_IIO_VOLTAGE,
+	ZEN_IIO_CURRENT,
+	ZEN_IIO_ENERGY,
+};
+
+struct zenpower_iio {
+	struct zenpower_data *data;
+	struct iio_chan_spec channels[ZEN_IIO_MAX_CHANNELS];
+	/* One scan; the timestamp is stored after the last enabled channel */
+	s64 scan[ZEN_IIO_MAX_CHANNELS] __aligned(8);
+};
+
+/* SVI2 plane registers read at most once per scan */
+struct zenpower_iio_planes {
+	u32 plane[2];
+	bool valid[2];
+};
+
+static u32 zenpower_iio_plane(struct zenpower_data *data,
+			      struct zenpower_iio_planes *p, int i)
+{
+	if (!p->valid[i]) {
+		data->read_amdsmn_addr(data->pdev, data->node_id,
+				       i ? data->svi_soc_addr : data->svi_core_addr,
+				       &p->plane[i]);
+		p->valid[i] = true;
+	}
+
+	return p->plane[i];
+}
+
+/* Whether the hwmon channel behind an IIO channel is enabled */
+static bool zenpower_iio_chan_on(struct zenpower_data *data,
+				 const struct iio_chan_spec *chan)
+{
+	switch (chan->address) {
+	case ZEN_IIO_TCTL:
+		return zenpower_chan_on(data, hwmon_temp, 1);
+	case ZEN_IIO_TCCD:
+		return zenpower_chan_on(data, hwmon_temp, chan->channel + 1);
+	case ZEN_IIO_VOLTAGE:
+		return zenpower_chan_on(data, hwmon_in, chan->channel + 1);
+	case ZEN_IIO_CURRENT:
+		return zenpower_chan_on(data, hwmon_curr, chan->channel);
+	case ZEN_IIO_ENERGY:
+		return zenpower_chan_on(data, hwmon_energy, 2);
+	default:
+		return false;
+	}
+}
+
+static int zenpower_iio_read(struct zenpower_data *data,
+			     const struct iio_chan_spec *chan,
+			     struct zenpower_iio_planes *p, s64 *val)
+{
+	long energy;
+	int err;
+
+	/* Disabled through hwmon *_enable; a scan stores 0 */
+	if (!zenpower_iio_chan_on(data, chan))
+		return -ENODATA;
+
+	switch (chan->address) {
+	case ZEN_IIO_TCTL:
+		*val = zenpower_temp_get_ctl(data);
+		return 0;
+	case ZEN_IIO_TCCD:
+		*val = zenpower_temp_get_ccd(data, data->ccd_addr[chan->channel - 1]);
+		return 0;
+	case ZEN_IIO_VOLTAGE:
+		*val = zenpower_svi2_plane_to_vcc(zenpower_iio_plane(data, p, chan->channel));
+		return 0;
+	case ZEN_IIO_CURRENT:
+		*val = zenpower_svi2_get_current(data, zenpower_iio_plane(data, p, chan->channel),
+						 chan->channel);
+		return 0;
+	case ZEN_IIO_ENERGY:
+		err = zenpower_rapl_read_energy(data, &energy);
+		if (err)
+			return err;
+		*val = energy;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static irqreturn_t zenpower_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct zenpower_iio *zi = iio_priv(indio_dev);
+	struct zenpower_iio_planes planes = { };
+	int bit, i = 0;
+
+	/* The timestamp is the last channel and is added by the push */
+	for_each_set_bit(bit, indio_dev->active_scan_mask, indio_dev->num_channels - 1) {
+		if (zenpower_iio_read(zi->data, &indio_dev->channels[bit], &planes,
+				      &zi->scan[i]))
+			zi->scan[i] = 0;
+		i++;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	iio_push_to_buffers_with_ts(indio_dev, zi->scan, sizeof(zi->scan),
+				    pf->timestamp);
+#else
+	iio_push_to_buffers_with_timestamp(indio_dev, zi->scan, pf->timestamp);
+#endif
+	iio_trigger_notify_done(indio_dev->trig);
+
+	return IRQ_HANDLED;
+}
+
+static int zenpower_iio_read_raw(struct iio_dev *indio_dev,
+				 struct iio_chan_spec const *chan,
+				 int *val, int *val2, long mask)
+{
+	struct zenpower_iio *zi = iio_priv(indio_dev);
+	struct zenpower_iio_planes planes = { };
+	s64 raw;
+	int err;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		err = zenpower_iio_read(zi->data, chan, &planes, &raw);
+		if (err)
+			return err;
+		*val = raw;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		if (chan->type == IIO_ENERGY) {
+			/* uJ to J */
+			*val = 0;
+			*val2 = 1;
+			return IIO_VAL_INT_PLUS_MICRO;
+		}
+		/* m°C, mV and mA are the IIO base units */
+		*val = 1;
+		return IIO_VAL_INT;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int zenpower_iio_read_label(struct iio_dev *indio_dev,
+				   struct iio_chan_spec const *chan, char *label)
+{
+	static const char * const plane[] = { "Core", "SoC" };
+
+	switch (chan->address) {
+	case ZEN_IIO_TCTL:
+		return sprintf(label, "Tctl\n");
+	case ZEN_IIO_TCCD:
+		return sprintf(label, "Tccd%d\n", chan->channel);
+	case ZEN_IIO_VOLTAGE:
+		return sprintf(label, "SVI2_%s\n", plane[chan->channel]);
+	case ZEN_IIO_CURRENT:
+		return sprintf(label, "SVI2_C_%s\n", plane[chan->channel]);
+	case ZEN_IIO_ENERGY:
+		return sprintf(label, "RAPL_E_Package\n");
+	default:
+		return -EINVAL;
+	}
+}
+
+static const struct iio_info zenpower_iio_info = {
+	.read_raw = zenpower_iio_read_raw,
+	.read_label = zenpower_iio_read_label,
+};
+
+static void zenpower_iio_add_channel(struct zenpower_iio *zi, int *n,
+				     enum iio_chan_type type, int channel,
+				     enum zenpower_iio_source source)
+{
+	struct iio_chan_spec *chan = &zi->channels[*n];
+
+	chan->type = type;
+	chan->indexed = 1;
+	chan->channel = channel;
+	chan->address = source;
+	/* No sysfs value for RAPL energy, which is root-only; see zenpower_bind_channels() */
+	if (source != ZEN_IIO_ENERGY)
+		chan->info_mask_separate = BIT(IIO_CHAN_INFO_RAW);
+	chan->info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE);
+	chan->scan_index = *n;
+	chan->scan_type.sign = 's';
+	chan->scan_type.realbits = 64;
+	chan->scan_type.storagebits = 64;
+	chan->scan_type.endianness = IIO_CPU;
+	(*n)++;
+}
+
+int zenpower_iio_init(struct zenpower_data *data, struct device *dev)
+{
+	struct iio_dev *indio_dev;
+	struct zenpower_iio *zi;
+	int i, n = 0;
+	int err;
+
+	if (!iio)
+		return 0;
+
+	indio_dev = devm_iio_device_alloc(dev, sizeof(*zi));
+	if (!indio_dev)
+		return -ENOMEM;
+
+	zi = iio_priv(indio_dev);
+	zi->data = data;
+
+	zenpower_iio_add_channel(zi, &n, IIO_TEMP, 0, ZEN_IIO_TCTL);
+	for (i = 0; i < 8; i++) {
+		if (data->ccd_visible[i])
+			zenpower_iio_add_channel(zi, &n, IIO_TEMP, i + 1, ZEN_IIO_TCCD);
+	}
+	if (data->svi_core_addr) {
+		zenpower_iio_add_channel(zi, &n, IIO_VOLTAGE, 0, ZEN_IIO_VOLTAGE);
+		zenpower_iio_add_channel(zi, &n, IIO_CURRENT, 0, ZEN_IIO_CURRENT);
+	}
+	if (data->svi_soc_addr) {
+		zenpower_iio_add_channel(zi, &n, IIO_VOLTAGE, 1, ZEN_IIO_VOLTAGE);
+		zenpower_iio_add_channel(zi, &n, IIO_CURRENT, 1, ZEN_IIO_CURRENT);
+	}
+	if (data->rapl_initialized)
+		zenpower_iio_add_channel(zi, &n, IIO_ENERGY, 0, ZEN_IIO_ENERGY);
+	zi->channels[n] = (struct iio_chan_spec)IIO_CHAN_SOFT_TIMESTAMP(n);
+	n++;
+
+	indio_dev->name = "zenpower";
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = zi->channels;
+	indio_dev->num_channels = n;
+	indio_dev->info = &zenpower_iio_info;
+
+	err = devm_iio_triggered_buffer_setup(dev, indio_dev,
+					      iio_pollfunc_store_time,
+					      zenpower_iio_trigger_handler, NULL);
+	if (err)
+		return err;
+
+	return devm_iio_device_register(dev, indio_dev);
+}
+
+#endif /* CONFIG_IIO_TRIGGERED_BUFFER */
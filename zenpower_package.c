@@ -0,0 +1,427 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - Per-socket and system aggregate devices
+ *
+ * Each DF node is its own hwmon device, and on multinode parts (ZEN_CFG_MULTINODE)
+ * node 0 only reports the SoC plane while node 1 reports the core plane.
+ * With package_interval_ms set, a "zenpower_pkg" hwmon device is registered
+ * per socket, plus a "zenpower_sys" device for the whole system. A single
+ * work item reads every member node in the same pass, so the values of one
+ * pass share a timestamp:
+ *
+ *   temp1/temp2     hottest Tctl and hottest CCD of the members
+ *   power1/power2   summed SVI2 core and SoC power
+ *   power3          package power over the last pass, from energy1
+ *   energy1         RAPL package energy, counted once per socket, or the
+ *                   summed SVI2 plane energy when RAPL is unavailable
+ *
+ * The work is deferrable, like the sampler tick: an idle system is not woken
+ * for it, and power3 uses the real time between passes.
+ *
+ * Membership follows the nodes probed when the module loads. A node unbound
+ * later drops out of the sums; power3 skips the pass where energy1 falls.
+ */
+
+#include "zenpower.h"
+#include <linux/hwmon.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+static unsigned int package_interval_ms;
+module_param(package_interval_ms, uint, 0444);
+MODULE_PARM_DESC(package_interval_ms, "Per-socket and system aggregate sampling period in ms (0 = disabled)");
+
+/* Values of one pass */
+struct zenpower_agg_values {
+	ktime_t time;
+	u64 svi2_power[2];      /* uW - [0]=core, [1]=SoC */
+	u64 energy;             /* uJ */
+	bool has_power;
+	u64 power;              /* uW since the previous pass */
+	bool has_tctl;          /* a member reported the value this pass */
+	bool has_tccd;
+	int tctl_max;           /* millidegrees */
+	int tccd_max;
+};
+
+/* Fold @temp into a running maximum that is valid once @has is set */
+static void zenpower_agg_max(bool *has, int *max, int temp)
+{
+	*max = *has ? max(*max, temp) : temp;
+	*has = true;
+}
+
+struct zenpower_agg {
+	struct platform_device *pdev;
+	struct device *hwmon;
+	int socket;             /* -1 for the system total */
+	bool has_plane[2];
+	bool has_tccd;
+	bool has_energy;
+	bool rapl;              /* energy from RAPL, else SVI2 */
+
+	/* Pass in progress, owned by the work */
+	struct zenpower_agg_values next;
+	bool rapl_counted;
+
+	/* Last completed pass, under zenpower_agg_lock */
+	struct zenpower_agg_values cur;
+};
+
+/* [0, nr_sockets) per socket, [nr_sockets] system total */
+static struct zenpower_agg *zenpower_aggs;
+static int zenpower_nr_sockets;
+static DEFINE_SPINLOCK(zenpower_agg_lock);
+static struct delayed_work zenpower_agg_work;
+
+/* Fold one member node into its socket's pass */
+static void zenpower_agg_node(struct zenpower_agg *agg, struct zenpower_data *data)
+{
+	struct zenpower_agg_values *v = &agg->next;
+	u32 addr[2] = { data->svi_core_addr, data->svi_soc_addr };
+	u32 plane;
+	long uj;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!addr[i] || !zenpower_plane_on(data, i))
+			continue;
+		data->read_amdsmn_addr(data->pdev, data->node_id, addr[i], &plane);
+		v->svi2_power[i] += zenpower_svi2_get_power(data, plane, i);
+	}
+
+	if (zenpower_chan_on(data, hwmon_temp, 0) || zenpower_chan_on(data, hwmon_temp, 1))
+		zenpower_agg_max(&v->has_tctl, &v->tctl_max,
+				 zenpower_temp_get_ctl(data));
+	for (i = 0; i < 8; i++) {
+		if (data->ccd_visible[i] && zenpower_chan_on(data, hwmon_temp, i + 2))
+			zenpower_agg_max(&v->has_tccd, &v->tccd_max,
+					 zenpower_temp_get_ccd(data, data->ccd_addr[i]));
+	}
+
+	/* Every node of a package reads the same RAPL package counter */
+	if (agg->rapl) {
+		if (!agg->rapl_counted && data->rapl_initialized &&
+		    !zenpower_rapl_read_energy(data, &uj)) {
+			v->energy += uj;
+			agg->rapl_counted = true;
+		}
+	} else if (data->svi2_energy) {
+		v->energy += zenpower_svi2_get_energy(data, 0) +
+			     zenpower_svi2_get_energy(data, 1);
+	}
+}
+
+/* Package power from the energy delta to the previous pass */
+static void zenpower_agg_power(struct zenpower_agg *agg)
+{
+	const struct zenpower_agg_values *prev = &agg->cur;
+	struct zenpower_agg_values *v = &agg->next;
+	s64 dt = ktime_to_ns(ktime_sub(v->time, prev->time));
+
+	if (!agg->has_energy || !prev->time || dt <= 0 || v->energy < prev->energy)
+		return;
+
+	/* uJ * 10^9 / ns = uW */
+	v->power = mul_u64_u64_div_u64(v->energy - prev->energy, NSEC_PER_SEC, dt);
+	v->has_power = true;
+}
+
+static void zenpower_agg_pass(void)
+{
+	struct zenpower_agg *sys = &zenpower_aggs[zenpower_nr_sockets];
+	struct zenpower_data *data;
+	ktime_t now = ktime_get();
+	int i;
+
+	for (i = 0; i <= zenpower_nr_sockets; i++) {
+		zenpower_aggs[i].next = (struct zenpower_agg_values) { .time = now };
+		zenpower_aggs[i].rapl_counted = false;
+	}
+
+	mutex_lock(&zenpower_devices_lock);
+	list_for_each_entry(data, &zenpower_devices, list) {
+		if (data->cpu_id < zenpower_nr_sockets)
+			zenpower_agg_node(&zenpower_aggs[data->cpu_id], data);
+	}
+	mutex_unlock(&zenpower_devices_lock);
+
+	for (i = 0; i < zenpower_nr_sockets; i++) {
+		struct zenpower_agg_values *v = &zenpower_aggs[i].next;
+
+		zenpower_agg_power(&zenpower_aggs[i]);
+		sys->next.svi2_power[0] += v->svi2_power[0];
+		sys->next.svi2_power[1] += v->svi2_power[1];
+		sys->next.energy += v->energy;
+		if (v->has_tctl)
+			zenpower_agg_max(&sys->next.has_tctl, &sys->next.tctl_max,
+					 v->tctl_max);
+		if (v->has_tccd)
+			zenpower_agg_max(&sys->next.has_tccd, &sys->next.tccd_max,
+					 v->tccd_max);
+	}
+	zenpower_agg_power(sys);
+
+	spin_lock(&zenpower_agg_lock);
+	for (i = 0; i <= zenpower_nr_sockets; i++)
+		zenpower_aggs[i].cur = zenpower_aggs[i].next;
+	spin_unlock(&zenpower_agg_lock);
+}
+
+static void zenpower_agg_work_fn(struct work_struct *work)
+{
+	zenpower_agg_pass();
+	queue_delayed_work(system_wq, &zenpower_agg_work,
+			   msecs_to_jiffies(package_interval_ms));
+}
+
+static umode_t zenpower_agg_is_visible(const void *rdata,
+				       enum hwmon_sensor_types type,
+				       u32 attr, int channel)
+{
+	const struct zenpower_agg *agg = rdata;
+
+	switch (type) {
+	case hwmon_temp:
+		if (channel == 1 && !agg->has_tccd)
+			return 0;
+		break;
+	case hwmon_power:
+		if (channel < 2 && !agg->has_plane[channel])
+			return 0;
+		if (channel == 2 && !agg->has_energy)
+			return 0;
+		break;
+	case hwmon_energy:
+		if (!agg->has_energy)
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	/* RAPL package energy is root-only, as on the node devices */
+	if (agg->rapl && (type == hwmon_energy || channel == 2))
+		return 0400;
+	return 0444;
+}
+
+static int zenpower_agg_read(struct device *dev, enum hwmon_sensor_types type,
+			     u32 attr, int channel, long *val)
+{
+	struct zenpower_agg *agg = dev_get_drvdata(dev);
+	struct zenpower_agg_values v;
+
+	spin_lock(&zenpower_agg_lock);
+	v = agg->cur;
+	spin_unlock(&zenpower_agg_lock);
+
+	switch (type) {
+	case hwmon_temp:
+		/* Every member channel is disabled */
+		if (!(channel ? v.has_tccd : v.has_tctl))
+			return -ENODATA;
+		*val = channel ? v.tccd_max : v.tctl_max;
+		break;
+	case hwmon_power:
+		if (channel < 2) {
+			*val = v.svi2_power[channel];
+			break;
+		}
+		/* No previous pass yet */
+		if (!v.has_power)
+			return -EAGAIN;
+		*val = v.power;
+		break;
+	case hwmon_energy:
+		*val = v.energy;
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+static const char *zenpower_agg_temp_label[] = { "Tctl_max", "Tccd_max" };
+static const char *zenpower_agg_power_label[] = { "SVI2_P_Core", "SVI2_P_SoC", "P_Package" };
+
+static int zenpower_agg_read_labels(struct device *dev,
+				    enum hwmon_sensor_types type, u32 attr,
+				    int channel, const char **str)
+{
+	switch (type) {
+	case hwmon_temp:
+		*str = zenpower_agg_temp_label[channel];
+		break;
+	case hwmon_power:
+		*str = zenpower_agg_power_label[channel];
+		break;
+	case hwmon_energy:
+		*str = "E_Package";
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+static const struct hwmon_channel_info *zenpower_agg_info[] = {
+	HWMON_CHANNEL_INFO(temp,
+			HWMON_T_INPUT | HWMON_T_LABEL,		// hottest Tctl
+			HWMON_T_INPUT | HWMON_T_LABEL),		// hottest Tccd
+	HWMON_CHANNEL_INFO(power,
+			HWMON_P_INPUT | HWMON_P_LABEL,		// Core Power (SVI2, summed)
+			HWMON_P_INPUT | HWMON_P_LABEL,		// SoC Power (SVI2, summed)
+			HWMON_P_INPUT | HWMON_P_LABEL),		// Package Power (from energy)
+	HWMON_CHANNEL_INFO(energy,
+			HWMON_E_INPUT | HWMON_E_LABEL),		// Package Energy
+	NULL
+};
+
+static const struct hwmon_ops zenpower_agg_hwmon_ops = {
+	.is_visible = zenpower_agg_is_visible,
+	.read = zenpower_agg_read,
+	.read_string = zenpower_agg_read_labels,
+};
+
+static const struct hwmon_chip_info zenpower_agg_chip_info = {
+	.ops = &zenpower_agg_hwmon_ops,
+	.info = zenpower_agg_info,
+};
+
+/* What the members of each socket provide. Caller holds zenpower_devices_lock. */
+static void zenpower_agg_scan(void)
+{
+	struct zenpower_agg *sys = &zenpower_aggs[zenpower_nr_sockets];
+	struct zenpower_data *data;
+	int i;
+
+	list_for_each_entry(data, &zenpower_devices, list) {
+		struct zenpower_agg *agg = &zenpower_aggs[data->cpu_id];
+
+		agg->has_plane[0] |= !!data->svi_core_addr;
+		agg->has_plane[1] |= !!data->svi_soc_addr;
+		agg->has_tccd |= !!memchr_inv(data->ccd_visible, 0,
+					      sizeof(data->ccd_visible));
+		agg->rapl |= data->rapl_initialized;
+		agg->has_energy |= data->rapl_initialized || data->svi2_energy;
+	}
+
+	for (i = 0; i < zenpower_nr_sockets; i++) {
+		sys->has_plane[0] |= zenpower_aggs[i].has_plane[0];
+		sys->has_plane[1] |= zenpower_aggs[i].has_plane[1];
+		sys->has_tccd |= zenpower_aggs[i].has_tccd;
+		sys->has_energy |= zenpower_aggs[i].has_energy;
+		sys->rapl |= zenpower_aggs[i].rapl;
+	}
+}
+
+static int zenpower_agg_register(struct zenpower_agg *agg)
+{
+	const char *name = agg->socket < 0 ? "zenpower_sys" : "zenpower_pkg";
+
+	agg->pdev = platform_device_register_simple(name,
+			agg->socket < 0 ? PLATFORM_DEVID_NONE : agg->socket, NULL, 0);
+	if (IS_ERR(agg->pdev)) {
+		int err = PTR_ERR(agg->pdev);
+
+		agg->pdev = NULL;
+		return err;
+	}
+
+	agg->hwmon = hwmon_device_register_with_info(&agg->pdev->dev, name, agg,
+						     &zenpower_agg_chip_info, NULL);
+	if (IS_ERR(agg->hwmon)) {
+		int err = PTR_ERR(agg->hwmon);
+
+		agg->hwmon = NULL;
+		platform_device_unregister(agg->pdev);
+		agg->pdev = NULL;
+		return err;
+	}
+
+	return 0;
+}
+
+static void zenpower_agg_unregister(struct zenpower_agg *agg)
+{
+	if (agg->hwmon)
+		hwmon_device_unregister(agg->hwmon);
+	if (agg->pdev)
+		platform_device_unregister(agg->pdev);
+}
+
+/* Register the aggregate devices over the nodes probed so far */
+int zenpower_package_init(void)
+{
+	struct zenpower_data *data;
+	int i, nr_sockets = 0;
+	int err;
+
+	if (!package_interval_ms)
+		return 0;
+
+	mutex_lock(&zenpower_devices_lock);
+	list_for_each_entry(data, &zenpower_devices, list)
+		nr_sockets = max(nr_sockets, data->cpu_id + 1);
+
+	if (!nr_sockets) {
+		mutex_unlock(&zenpower_devices_lock);
+		return 0;
+	}
+
+	zenpower_aggs = kcalloc(nr_sockets + 1, sizeof(*zenpower_aggs), GFP_KERNEL);
+	if (!zenpower_aggs) {
+		mutex_unlock(&zenpower_devices_lock);
+		return -ENOMEM;
+	}
+	zenpower_nr_sockets = nr_sockets;
+	for (i = 0; i <= nr_sockets; i++)
+		zenpower_aggs[i].socket = i < nr_sockets ? i : -1;
+	zenpower_agg_scan();
+	mutex_unlock(&zenpower_devices_lock);
+
+	/* Serve the first reads from a completed pass */
+	zenpower_agg_pass();
+
+	for (i = 0; i <= nr_sockets; i++) {
+		err = zenpower_agg_register(&zenpower_aggs[i]);
+		if (err)
+			goto err_unregister;
+	}
+
+	INIT_DEFERRABLE_WORK(&zenpower_agg_work, zenpower_agg_work_fn);
+	queue_delayed_work(system_wq, &zenpower_agg_work,
+			   msecs_to_jiffies(package_interval_ms));
+
+	dev_info(&zenpower_aggs[nr_sockets].pdev->dev,
+		 "Aggregating %d socket(s) every %u ms\n", nr_sockets, package_interval_ms);
+	return 0;
+
+err_unregister:
+	while (i--)
+		zenpower_agg_unregister(&zenpower_aggs[i]);
+	kfree(zenpower_aggs);
+	zenpower_aggs = NULL;
+	return err;
+}
+
+void zenpower_package_exit(void)
+{
+	int i;
+
+	if (!zenpower_aggs)
+		return;
+
+	cancel_delayed_work_sync(&zenpower_agg_work);
+	for (i = 0; i <= zenpower_nr_sockets; i++)
+		zenpower_agg_unregister(&zenpower_aggs[i]);
+	kfree(zenpower_aggs);
+	zenpower_aggs = NULL;
+}
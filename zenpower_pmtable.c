@@ -0,0 +1,605 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - SMU PM table backend
+ *
+ * The SMU keeps a power management (PM) table with hundreds of metrics
+ * (PPT/TDC/EDC usage and limits, fabric and memory clocks, per-core power
+ * and frequency). The table is copied to DRAM on request through the SMU
+ * mailbox, so a single transfer yields every metric at once.
+ *
+ * Table layouts differ per model and per table version, so decoding is
+ * driven by the per-model layouts referenced from model_configs. Offsets
+ * are from the community documentation of the tables (ryzen_smu and
+ * ryzen_monitor); a layout is only used when the table version reported by
+ * the SMU matches.
+ *
+ * A mock mailbox backed by a kernel buffer is provided so the backend can
+ * be exercised without talking to the SMU (pm_table_mock=1). It serves the
+ * model's own layout and table version, or the Vermeer one on models without
+ * a known table, so the real decoders are what gets tested.
+ *
+ * The RSMU mailbox has no arbitration between its users. A busy response
+ * is retried, but a second kernel user sending messages at the same time
+ * can still interleave with ours, so the hardware mailbox is refused while
+ * the ryzen_smu module is loaded. Running SMU tools that poke the mailbox
+ * from userspace alongside pm_table=1 is not supported either.
+ */
+
+#include "zenpower.h"
+#include <linux/delay.h>
+#include <linux/io.h>
+#include <linux/kobject.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+
+#define ZEN_SMU_NUM_ARGS        6
+#define ZEN_SMU_TIMEOUT_US      20000
+#define ZEN_SMU_BUSY_RETRIES    8
+
+/* SMU mailbox response codes */
+#define ZEN_SMU_RSP_OK          0x01
+#define ZEN_SMU_RSP_FAILED      0xff
+#define ZEN_SMU_RSP_UNKNOWN_CMD 0xfe
+#define ZEN_SMU_RSP_REJECTED    0xfd
+#define ZEN_SMU_RSP_BUSY        0xfc
+
+/* Minimum interval between two table transfers; readers share the snapshot */
+#define ZEN_PMT_REFRESH_MS      50
+
+/* RSMU mailbox used by Matisse and Vermeer desktop parts */
+#define F17H_RSMU_CMD           0x03b10524
+#define F17H_RSMU_RSP           0x03b10570
+#define F17H_RSMU_ARGS          0x03b10a40
+
+#define PMT(off)                { .offset = (off), .valid = true }
+
+struct zenpower_pmtable;
+
+struct zenpower_smu_mailbox {
+	const char *name;
+	int (*send)(struct zenpower_data *data, struct zenpower_pmtable *pmt,
+		    u32 msg, u32 *args);
+	int (*map)(struct zenpower_data *data, struct zenpower_pmtable *pmt,
+		   struct device *dev, u64 base);
+};
+
+struct zenpower_pmtable {
+	const struct zenpower_pmtable_layout *layout;
+	const struct zenpower_smu_mailbox *mb;
+	struct mutex lock;          /* serialises mailbox use and snapshot */
+	void __iomem *iomem;        /* SMU DRAM table (hardware mailbox) */
+	u8 *mock_mem;               /* emulated DRAM table (mock mailbox) */
+	u8 *buf;                    /* last snapshot */
+	ktime_t last_refresh;
+	u64 transfers;
+	u32 version;
+	u32 mock_seq;
+};
+
+/* Zen 2 Matisse (17h/71h), table version 0x240903 */
+const struct zenpower_pmtable_layout zenpower_pmt_matisse = {
+	.mb_cmd = F17H_RSMU_CMD,
+	.mb_rsp = F17H_RSMU_RSP,
+	.mb_args = F17H_RSMU_ARGS,
+	.cmd_transfer = 0x05,
+	.cmd_get_base = 0x06,
+	.cmd_get_version = 0x08,
+	.version = 0x240903,
+	.size = 0x7e4,
+	.field = {
+		[ZEN_PMT_PPT_LIMIT] = PMT(0x000),
+		[ZEN_PMT_PPT_VALUE] = PMT(0x004),
+		[ZEN_PMT_TDC_LIMIT] = PMT(0x008),
+		[ZEN_PMT_TDC_VALUE] = PMT(0x00c),
+		[ZEN_PMT_THM_LIMIT] = PMT(0x010),
+		[ZEN_PMT_THM_VALUE] = PMT(0x014),
+		[ZEN_PMT_EDC_LIMIT] = PMT(0x020),
+		[ZEN_PMT_EDC_VALUE] = PMT(0x024),
+		[ZEN_PMT_FCLK] = PMT(0x0c0),
+		[ZEN_PMT_UCLK] = PMT(0x0c8),
+		[ZEN_PMT_MCLK] = PMT(0x0cc),
+	},
+	.name = "Matisse 0x240903",
+};
+
+/* Zen 3 Vermeer (19h/21h), table version 0x380805 */
+const struct zenpower_pmtable_layout zenpower_pmt_vermeer = {
+	.mb_cmd = F17H_RSMU_CMD,
+	.mb_rsp = F17H_RSMU_RSP,
+	.mb_args = F17H_RSMU_ARGS,
+	.cmd_transfer = 0x05,
+	.cmd_get_base = 0x06,
+	.cmd_get_version = 0x08,
+	.version = 0x380805,
+	.size = 0x8f0,
+	.field = {
+		[ZEN_PMT_PPT_LIMIT] = PMT(0x000),
+		[ZEN_PMT_PPT_VALUE] = PMT(0x004),
+		[ZEN_PMT_TDC_LIMIT] = PMT(0x008),
+		[ZEN_PMT_TDC_VALUE] = PMT(0x00c),
+		[ZEN_PMT_THM_LIMIT] = PMT(0x010),
+		[ZEN_PMT_THM_VALUE] = PMT(0x014),
+		[ZEN_PMT_EDC_LIMIT] = PMT(0x020),
+		[ZEN_PMT_EDC_VALUE] = PMT(0x024),
+		[ZEN_PMT_FCLK] = PMT(0x0c0),
+		[ZEN_PMT_UCLK] = PMT(0x0c8),
+		[ZEN_PMT_MCLK] = PMT(0x0cc),
+	},
+	.core_power = 0x24c,
+	.core_freq = 0x30c,
+	.max_cores = 16,
+	.name = "Vermeer 0x380805",
+};
+
+static const char * const zenpower_pmt_metric_name[ZEN_PMT_NR_METRICS] = {
+	[ZEN_PMT_PPT_LIMIT] = "ppt_limit",
+	[ZEN_PMT_PPT_VALUE] = "ppt",
+	[ZEN_PMT_TDC_LIMIT] = "tdc_limit",
+	[ZEN_PMT_TDC_VALUE] = "tdc",
+	[ZEN_PMT_EDC_LIMIT] = "edc_limit",
+	[ZEN_PMT_EDC_VALUE] = "edc",
+	[ZEN_PMT_THM_LIMIT] = "thm_limit",
+	[ZEN_PMT_THM_VALUE] = "thm",
+	[ZEN_PMT_FCLK] = "fclk",
+	[ZEN_PMT_UCLK] = "uclk",
+	[ZEN_PMT_MCLK] = "mclk",
+	[ZEN_PMT_FMAX] = "fmax",
+};
+
+/*
+ * Convert an IEEE-754 single precision value (as stored by the SMU) to an
+ * integer scaled by 1000, without touching the FPU.
+ */
+static s64 pmt_f32_to_milli(u32 bits)
+{
+	u32 biased = (bits >> 23) & 0xff;
+	u64 mant;
+	s64 v;
+	int shift;
+
+	/* Zero, denormals, infinities and NaNs carry no useful reading */
+	if (biased == 0 || biased == 0xff)
+		return 0;
+
+	mant = ((bits & 0x7fffff) | BIT(23)) * 1000ULL;
+	shift = (int)biased - 127 - 23;
+
+	if (shift >= 0)
+		v = shift > 28 ? S64_MAX : (s64)(mant << shift);
+	else
+		v = -shift > 63 ? 0 : (s64)(mant >> -shift);
+
+	return (bits & BIT(31)) ? -v : v;
+}
+
+/* Build an IEEE-754 single precision value from an integer scaled by 1000 */
+static u32 pmt_milli_to_f32(u32 milli)
+{
+	u64 mant = milli;
+	int exp;
+
+	if (!milli)
+		return 0;
+
+	/* Normalise value * 2^exp / 1000 into 24 bits of mantissa */
+	mant = div_u64(mant << 32, 1000);
+	exp = -32;
+	while (mant >= BIT_ULL(24)) {
+		mant >>= 1;
+		exp++;
+	}
+	while (mant < BIT_ULL(23)) {
+		mant <<= 1;
+		exp--;
+	}
+
+	return ((u32)(exp + 23 + 127) << 23) | ((u32)mant & 0x7fffff);
+}
+
+static u32 pmt_raw(const struct zenpower_pmtable *pmt, u16 offset)
+{
+	u32 raw;
+
+	memcpy(&raw, pmt->buf + offset, sizeof(raw));
+	return raw;
+}
+
+/* Hardware mailbox: SMN register based SMU message interface */
+
+static int smu_wait_rsp(struct zenpower_data *data, u32 rsp_addr, u32 *rsp)
+{
+	unsigned int waited;
+
+	for (waited = 0; waited < ZEN_SMU_TIMEOUT_US; waited += 20) {
+		data->read_amdsmn_addr(data->pdev, data->node_id, rsp_addr, rsp);
+		if (*rsp)
+			return 0;
+		usleep_range(20, 40);
+	}
+
+	return -ETIMEDOUT;
+}
+
+static int smu_hw_send(struct zenpower_data *data, struct zenpower_pmtable *pmt,
+		       u32 msg, u32 *args)
+{
+	const struct zenpower_pmtable_layout *l = pmt->layout;
+	unsigned int tries = 0;
+	u32 rsp;
+	int i, err;
+
+retry:
+	/* Make sure a previous message (from anyone) has completed */
+	err = smu_wait_rsp(data, l->mb_rsp, &rsp);
+	if (err)
+		return err;
+
+	data->write_amdsmn_addr(data->pdev, data->node_id, l->mb_rsp, 0);
+	for (i = 0; i < ZEN_SMU_NUM_ARGS; i++)
+		data->write_amdsmn_addr(data->pdev, data->node_id,
+					l->mb_args + i * 4, args[i]);
+	data->write_amdsmn_addr(data->pdev, data->node_id, l->mb_cmd, msg);
+
+	err = smu_wait_rsp(data, l->mb_rsp, &rsp);
+	if (err)
+		return err;
+
+	switch (rsp) {
+		case ZEN_SMU_RSP_OK:
+			break;
+		case ZEN_SMU_RSP_UNKNOWN_CMD:
+			return -EOPNOTSUPP;
+		case ZEN_SMU_RSP_BUSY:
+			/* The SMU did not take the message; send it again */
+			if (++tries >= ZEN_SMU_BUSY_RETRIES)
+				return -EBUSY;
+			usleep_range(1000, 2000);
+			goto retry;
+		case ZEN_SMU_RSP_REJECTED:
+		case ZEN_SMU_RSP_FAILED:
+		default:
+			return -EIO;
+	}
+
+	for (i = 0; i < ZEN_SMU_NUM_ARGS; i++)
+		data->read_amdsmn_addr(data->pdev, data->node_id,
+				       l->mb_args + i * 4, &args[i]);
+
+	return 0;
+}
+
+/* The RSMU mailbox is not arbitrated; do not share it with ryzen_smu */
+static bool smu_hw_other_user(void)
+{
+	struct kobject *kobj;
+
+	kobj = kset_find_obj(module_kset, "ryzen_smu");
+	if (!kobj)
+		return false;
+
+	kobject_put(kobj);
+	return true;
+}
+
+static int smu_hw_map(struct zenpower_data *data, struct zenpower_pmtable *pmt,
+		      struct device *dev, u64 base)
+{
+	if (!base)
+		return -ENXIO;
+
+	pmt->iomem = devm_ioremap(dev, base, pmt->layout->size);
+	if (!pmt->iomem)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static const struct zenpower_smu_mailbox smu_hw_mailbox = {
+	.name = "SMU",
+	.send = smu_hw_send,
+	.map = smu_hw_map,
+};
+
+/*
+ * Mock mailbox: answers the three PM table messages with the version of the
+ * layout in use, and fills an emulated DRAM table at that layout's offsets
+ * with slowly varying synthetic values on every transfer.
+ */
+
+static void smu_mock_put(struct zenpower_pmtable *pmt, u16 offset, u32 milli)
+{
+	u32 raw = pmt_milli_to_f32(milli);
+
+	memcpy(pmt->mock_mem + offset, &raw, sizeof(raw));
+}
+
+/* Metrics the layout does not decode are left alone */
+static void smu_mock_field(struct zenpower_pmtable *pmt,
+			   enum zenpower_pmt_metric m, u32 milli)
+{
+	const struct zenpower_pmt_field *f = &pmt->layout->field[m];
+
+	if (f->valid)
+		smu_mock_put(pmt, f->offset, milli);
+}
+
+static void smu_mock_fill(struct zenpower_pmtable *pmt)
+{
+	const struct zenpower_pmtable_layout *l = pmt->layout;
+	u32 wobble = pmt->mock_seq++ % 16;
+	int i;
+
+	smu_mock_field(pmt, ZEN_PMT_PPT_LIMIT, 142000);
+	smu_mock_field(pmt, ZEN_PMT_PPT_VALUE, 60000 + wobble * 1000);
+	smu_mock_field(pmt, ZEN_PMT_TDC_LIMIT, 95000);
+	smu_mock_field(pmt, ZEN_PMT_TDC_VALUE, 40000 + wobble * 500);
+	smu_mock_field(pmt, ZEN_PMT_THM_LIMIT, 90000);
+	smu_mock_field(pmt, ZEN_PMT_THM_VALUE, 50000 + wobble * 250);
+	smu_mock_field(pmt, ZEN_PMT_EDC_LIMIT, 140000);
+	smu_mock_field(pmt, ZEN_PMT_EDC_VALUE, 70000 + wobble * 750);
+	smu_mock_field(pmt, ZEN_PMT_FCLK, 1800000);
+	smu_mock_field(pmt, ZEN_PMT_UCLK, 1800000);
+	smu_mock_field(pmt, ZEN_PMT_MCLK, 1800000);
+	smu_mock_field(pmt, ZEN_PMT_FMAX, 4850000);
+
+	for (i = 0; i < l->max_cores; i++) {
+		if (l->core_power)
+			smu_mock_put(pmt, l->core_power + i * 4,
+				     2000 + ((wobble + i) % 16) * 250);
+		if (l->core_freq)
+			smu_mock_put(pmt, l->core_freq + i * 4,
+				     3600 + ((wobble + i) % 16) * 50);
+	}
+}
+
+static int smu_mock_send(struct zenpower_data *data, struct zenpower_pmtable *pmt,
+			 u32 msg, u32 *args)
+{
+	const struct zenpower_pmtable_layout *l = pmt->layout;
+
+	memset(args, 0, ZEN_SMU_NUM_ARGS * sizeof(*args));
+
+	if (msg == l->cmd_transfer) {
+		smu_mock_fill(pmt);
+	} else if (msg == l->cmd_get_base) {
+		/* Any non-zero cookie; smu_mock_map() ignores it */
+		args[0] = 0x1000;
+	} else if (msg == l->cmd_get_version) {
+		args[0] = l->version;
+	} else {
+		return -EOPNOTSUPP;
+	}
+
+	return 0;
+}
+
+static int smu_mock_map(struct zenpower_data *data, struct zenpower_pmtable *pmt,
+			struct device *dev, u64 base)
+{
+	pmt->mock_mem = zenpower_devm_kzalloc(data, dev, pmt->layout->size);
+	if (!pmt->mock_mem)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static const struct zenpower_smu_mailbox smu_mock_mailbox = {
+	.name = "mock",
+	.send = smu_mock_send,
+	.map = smu_mock_map,
+};
+
+static int pmt_transfer(struct zenpower_data *data, struct zenpower_pmtable *pmt)
+{
+	u32 args[ZEN_SMU_NUM_ARGS] = { 0 };
+	int err;
+
+	err = pmt->mb->send(data, pmt, pmt->layout->cmd_transfer, args);
+	if (err)
+		return err;
+
+	if (pmt->iomem)
+		memcpy_fromio(pmt->buf, pmt->iomem, pmt->layout->size);
+	else
+		memcpy(pmt->buf, pmt->mock_mem, pmt->layout->size);
+
+	pmt->last_refresh = ktime_get();
+	pmt->transfers++;
+
+	return 0;
+}
+
+int zenpower_pmtable_init(struct zenpower_data *data, struct device *dev,
+			  const struct zenpower_pmtable_layout *layout, bool mock)
+{
+	struct zenpower_pmtable *pmt;
+	u32 args[ZEN_SMU_NUM_ARGS] = { 0 };
+	u64 base;
+	int err;
+
+	/* The mock serves a real layout, so that its decoder is exercised */
+	if (mock && !layout)
+		layout = &zenpower_pmt_vermeer;
+	if (!layout)
+		return -EOPNOTSUPP;
+
+	/* The hardware mailbox needs SMN writes through the kernel SMN API */
+	if (!mock && !data->kernel_smn_support)
+		return -EOPNOTSUPP;
+
+	if (!mock && smu_hw_other_user()) {
+		dev_warn(dev, "ryzen_smu is loaded, not sharing the SMU mailbox\n");
+		return -EBUSY;
+	}
+
+	pmt = zenpower_devm_kzalloc(data, dev, sizeof(*pmt));
+	if (!pmt)
+		return -ENOMEM;
+
+	pmt->buf = zenpower_devm_kzalloc(data, dev, layout->size);
+	if (!pmt->buf)
+		return -ENOMEM;
+
+	mutex_init(&pmt->lock);
+	pmt->layout = layout;
+	pmt->mb = mock ? &smu_mock_mailbox : &smu_hw_mailbox;
+
+	err = pmt->mb->send(data, pmt, layout->cmd_get_version, args);
+	if (err)
+		return err;
+
+	pmt->version = args[0];
+	if (pmt->version != layout->version) {
+		dev_info(dev, "PM table version 0x%06x not supported (expected 0x%06x)\n",
+			 pmt->version, layout->version);
+		return -EOPNOTSUPP;
+	}
+
+	/* The DRAM base is only valid once a first transfer has been made */
+	memset(args, 0, sizeof(args));
+	err = pmt->mb->send(data, pmt, layout->cmd_transfer, args);
+	if (err)
+		return err;
+
+	memset(args, 0, sizeof(args));
+	err = pmt->mb->send(data, pmt, layout->cmd_get_base, args);
+	if (err)
+		return err;
+
+	base = (u64)args[1] << 32 | args[0];
+	err = pmt->mb->map(data, pmt, dev, base);
+	if (err)
+		return err;
+
+	err = pmt_transfer(data, pmt);
+	if (err)
+		return err;
+
+	data->pmt = pmt;
+	dev_info(dev, "PM table: %s via %s mailbox, %u bytes\n",
+		 layout->name, pmt->mb->name, layout->size);
+
+	return 0;
+}
+
+/* Refresh the snapshot unless it is recent enough. Caller holds pmt->lock. */
+static int pmt_refresh(struct zenpower_data *data, struct zenpower_pmtable *pmt)
+{
+	if (pmt->transfers &&
+	    ktime_ms_delta(ktime_get(), pmt->last_refresh) < ZEN_PMT_REFRESH_MS)
+		return 0;
+
+	return pmt_transfer(data, pmt);
+}
+
+/* Periodic refresh from the sampler, so readers are served from the snapshot */
+void zenpower_pmtable_sample(struct zenpower_data *data)
+{
+	struct zenpower_pmtable *pmt = data->pmt;
+
+	mutex_lock(&pmt->lock);
+	pmt_transfer(data, pmt);
+	mutex_unlock(&pmt->lock);
+}
+
+bool zenpower_pmtable_has(const struct zenpower_data *data, enum zenpower_pmt_metric m)
+{
+	return data->pmt && data->pmt->layout->field[m].valid;
+}
+
+int zenpower_pmtable_read(struct zenpower_data *data, enum zenpower_pmt_metric m,
+			  long *val)
+{
+	struct zenpower_pmtable *pmt = data->pmt;
+	int err;
+
+	if (!zenpower_pmtable_has(data, m))
+		return -EOPNOTSUPP;
+
+	mutex_lock(&pmt->lock);
+	err = pmt_refresh(data, pmt);
+	if (!err)
+		*val = pmt_f32_to_milli(pmt_raw(pmt, pmt->layout->field[m].offset));
+	mutex_unlock(&pmt->lock);
+
+	return err;
+}
+
+/*
+ * hwmon handlers for PPT, TDC and EDC; ch->index and ch->limit are the value
+ * and limit metrics. The table holds W and A, which zenpower_pmtable_read()
+ * returns scaled to mW and mA.
+ */
+int zenpower_pmtable_hwmon_curr(struct zenpower_data *data,
+				const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	return zenpower_pmtable_read(data, attr == hwmon_curr_max ?
+				     ch->limit : ch->index, val);
+}
+
+int zenpower_pmtable_hwmon_power(struct zenpower_data *data,
+				 const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	long milli;
+	int err;
+
+	err = zenpower_pmtable_read(data, attr == hwmon_power_cap ?
+				    ch->limit : ch->index, &milli);
+	if (err)
+		return err;
+
+	*val = milli * 1000;
+	return 0;
+}
+
+ssize_t zenpower_pmtable_show(struct zenpower_data *data, char *buf)
+{
+	struct zenpower_pmtable *pmt = data->pmt;
+	const struct zenpower_pmtable_layout *l;
+	int i, err, len = 0;
+
+	if (!pmt)
+		return -ENODEV;
+
+	l = pmt->layout;
+
+	mutex_lock(&pmt->lock);
+	err = pmt_refresh(data, pmt);
+	if (err) {
+		mutex_unlock(&pmt->lock);
+		return err;
+	}
+
+	len += scnprintf(buf + len, PAGE_SIZE - len, "VERSION: 0x%06x (%s)\n",
+			 pmt->version, l->name);
+	len += scnprintf(buf + len, PAGE_SIZE - len, "TRANSFERS: %llu\n",
+			 pmt->transfers);
+
+	for (i = 0; i < ZEN_PMT_NR_METRICS; i++) {
+		if (!l->field[i].valid)
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s = %lld\n",
+				 zenpower_pmt_metric_name[i],
+				 pmt_f32_to_milli(pmt_raw(pmt, l->field[i].offset)));
+	}
+
+	/*
+	 * Values are milli-units of the SMU's own unit: W -> mW, A -> mA,
+	 * degC -> millidegC, MHz -> kHz; per-core clocks are kept in GHz by the
+	 * SMU and therefore print in MHz.
+	 */
+	for (i = 0; i < l->max_cores; i++) {
+		if (l->core_power)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "core%d_power = %lld\n", i,
+					 pmt_f32_to_milli(pmt_raw(pmt, l->core_power + i * 4)));
+		if (l->core_freq)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "core%d_freq = %lld\n", i,
+					 pmt_f32_to_milli(pmt_raw(pmt, l->core_freq + i * 4)));
+	}
+
+	mutex_unlock(&pmt->lock);
+
+	return len;
+}
@@ -0,0 +1,400 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - Software package power cap
+ *
+ * Zen exposes no RAPL power-limit MSR to Linux, so the cap is enforced in
+ * software: a closed loop on the sampler compares the RAPL package power
+ * with the target and lowers or raises one cpufreq maximum for every policy
+ * of the package, through freq QoS requests. Enabled with power_cap=1;
+ * requires sample_interval_ms and the RAPL package counter.
+ *
+ * The target is power4_cap (RAPL_P_Package, power1_cap on Zen 5) in uW,
+ * writable at runtime and initialised from power_cap_w; 0 releases the limit.
+ * Other files:
+ *
+ *   power_cap_state     off, idle, limiting or saturated
+ *   power_cap_power     package power seen by the controller (uW, smoothed)
+ *   power_cap_freq      frequency limit applied to the policies (kHz)
+ *
+ * Every ZEN_PCAP_PERIOD_MS the controller takes the package power from the
+ * RAPL accumulator, smooths it, and moves the limit by a share of the
+ * relative error: quickly down when over target, more slowly back up when
+ * below it by more than ZEN_PCAP_HYST. The QoS requests are only updated
+ * when the limit moves by at least ZEN_PCAP_MIN_STEP_KHZ, as each update
+ * re-evaluates every policy.
+ *
+ * The controller runs on the sampler's tick, which is kept strict while a
+ * node has a controller (see zenpower_sampler_strict()): a deferred tick
+ * would let the package run over its cap for as long as its CPU sleeps.
+ *
+ * On multinode parts only the first node of a package runs the controller,
+ * as all of them read the same package counter. Policies are tracked through
+ * a cpufreq policy notifier, as drivers/acpi/processor_thermal.c does: a
+ * request is added when a policy of the package is created and removed when
+ * it goes away, so a cpufreq driver can be switched or unloaded while the
+ * cap is active. No policy reference is held.
+ */
+
+#include "zenpower.h"
+#include <linux/cpu.h>
+#include <linux/cpufreq.h>
+#include <linux/hwmon-sysfs.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/notifier.h>
+#include <linux/pm_qos.h>
+#include <linux/slab.h>
+#include <linux/topology.h>
+
+static bool power_cap;
+module_param(power_cap, bool, 0444);
+MODULE_PARM_DESC(power_cap, "Enable the software package power cap controller (default 0)");
+
+static unsigned int power_cap_w;
+module_param(power_cap_w, uint, 0444);
+MODULE_PARM_DESC(power_cap_w, "Initial package power cap in W (0 = no limit until power4_cap is written)");
+
+#define ZEN_PCAP_PERIOD_MS      100
+#define ZEN_PCAP_HYST           3       /* percent below target before raising */
+#define ZEN_PCAP_MIN_STEP_KHZ   25000
+#define ZEN_PCAP_MAX_UW         1000000000ULL   /* 1 kW */
+
+enum zenpower_pcap_state {
+	ZEN_PCAP_OFF,
+	ZEN_PCAP_IDLE,
+	ZEN_PCAP_LIMITING,
+	ZEN_PCAP_SATURATED,
+};
+
+static const char *const zenpower_pcap_state_names[] = {
+	[ZEN_PCAP_OFF] = "off",
+	[ZEN_PCAP_IDLE] = "idle",
+	[ZEN_PCAP_LIMITING] = "limiting",
+	[ZEN_PCAP_SATURATED] = "saturated",
+};
+
+struct zenpower_pcap {
+	struct mutex lock;              /* also serialises the policy notifier */
+	struct notifier_block nb;
+	u8 package;
+	bool closing;                   /* no new requests, being released */
+	u64 target;             /* uW, 0 = no limit */
+	u64 power;              /* uW, smoothed */
+	unsigned int freq;      /* current limit, kHz */
+	unsigned int applied;   /* limit in the QoS requests, kHz */
+	unsigned int freq_min;
+	unsigned int freq_max;
+	enum zenpower_pcap_state state;
+
+	/* Energy at the previous step */
+	ktime_t last;
+	u64 last_energy;
+
+	/* One request per policy, indexed by the policy's first related CPU */
+	int nr_policies;
+	struct freq_qos_request req[];
+};
+
+static void zenpower_pcap_apply(struct zenpower_pcap *pc, unsigned int freq)
+{
+	unsigned int cpu;
+
+	if (abs_diff(freq, pc->applied) < ZEN_PCAP_MIN_STEP_KHZ &&
+	    freq != pc->freq_max && freq != pc->freq_min)
+		return;
+	if (freq == pc->applied)
+		return;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		if (freq_qos_request_active(&pc->req[cpu]))
+			freq_qos_update_request(&pc->req[cpu], freq);
+	}
+	pc->applied = freq;
+}
+
+/* One controller step. Caller holds pc->lock. */
+static void zenpower_pcap_step(struct zenpower_pcap *pc, u64 power)
+{
+	u64 f = pc->freq, delta;
+
+	pc->power = pc->power ? (pc->power + power) / 2 : power;
+
+	/* Nothing to act on until a policy of the package exists */
+	if (!pc->nr_policies)
+		return;
+
+	if (!pc->target) {
+		pc->freq = pc->freq_max;
+		pc->state = ZEN_PCAP_OFF;
+		zenpower_pcap_apply(pc, pc->freq);
+		return;
+	}
+
+	if (pc->power > pc->target) {
+		/* Power grows faster than f: half the relative error is enough */
+		delta = div64_u64(f * (pc->power - pc->target), 2 * pc->power);
+		f = f > pc->freq_min + delta ? f - delta : pc->freq_min;
+	} else if (pc->power * 100 < pc->target * (100 - ZEN_PCAP_HYST)) {
+		delta = div64_u64(f * (pc->target - pc->power), 4 * max(pc->power, 1ULL));
+		f = min_t(u64, f + delta, pc->freq_max);
+	}
+
+	pc->freq = f;
+	if (f == pc->freq_max)
+		pc->state = ZEN_PCAP_IDLE;
+	else if (f == pc->freq_min && pc->power > pc->target)
+		pc->state = ZEN_PCAP_SATURATED;
+	else
+		pc->state = ZEN_PCAP_LIMITING;
+
+	zenpower_pcap_apply(pc, pc->freq);
+}
+
+/* Called by the sampler on every pass with the pass' RAPL energy */
+void zenpower_powercap_sample(struct zenpower_data *data,
+			      const struct zenpower_sample *s)
+{
+	struct zenpower_pcap *pc = data->pcap;
+	s64 dt;
+
+	if (!s->rapl_energy)
+		return;
+
+	dt = ktime_to_ns(ktime_sub(s->time, pc->last));
+	if (pc->last && dt < ZEN_PCAP_PERIOD_MS * NSEC_PER_MSEC)
+		return;
+
+	mutex_lock(&pc->lock);
+	if (pc->last && dt > 0 && s->rapl_energy >= pc->last_energy)
+		/* uJ * 10^9 / ns = uW */
+		zenpower_pcap_step(pc, mul_u64_u64_div_u64(s->rapl_energy - pc->last_energy,
+							   NSEC_PER_SEC, dt));
+	pc->last = s->time;
+	pc->last_energy = s->rapl_energy;
+	mutex_unlock(&pc->lock);
+}
+
+/* RAPL package power, with the cap */
+int zenpower_powercap_hwmon_power(struct zenpower_data *data,
+				  const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	struct zenpower_pcap *pc = data->pcap;
+
+	if (attr != hwmon_power_cap)
+		return zenpower_rapl_hwmon_power(data, ch, attr, val);
+
+	mutex_lock(&pc->lock);
+	*val = pc->target;
+	mutex_unlock(&pc->lock);
+
+	return 0;
+}
+
+int zenpower_powercap_hwmon_write(struct zenpower_data *data,
+				  const struct zenpower_channel *ch, u32 attr, long val)
+{
+	struct zenpower_pcap *pc = data->pcap;
+
+	if (attr != hwmon_power_cap)
+		return -EOPNOTSUPP;
+	if (val < 0 || (val && val < 1000000) || val > ZEN_PCAP_MAX_UW)
+		return -EINVAL;
+
+	mutex_lock(&pc->lock);
+	pc->target = val;
+	if (!val) {
+		pc->freq = pc->freq_max;
+		pc->state = ZEN_PCAP_OFF;
+		zenpower_pcap_apply(pc, pc->freq);
+	}
+	mutex_unlock(&pc->lock);
+
+	return 0;
+}
+
+static ssize_t power_cap_show(struct device *dev, struct device_attribute *attr,
+			      char *buf)
+{
+	struct zenpower_data *data = dev_get_drvdata(dev);
+	struct zenpower_pcap *pc = data->pcap;
+	int index = to_sensor_dev_attr(attr)->index;
+	ssize_t len;
+
+	mutex_lock(&pc->lock);
+	switch (index) {
+	case 0:
+		len = sysfs_emit(buf, "%s\n", zenpower_pcap_state_names[pc->state]);
+		break;
+	case 1:
+		len = sysfs_emit(buf, "%llu\n", pc->power);
+		break;
+	default:
+		len = sysfs_emit(buf, "%u\n", pc->freq);
+		break;
+	}
+	mutex_unlock(&pc->lock);
+
+	return len;
+}
+
+static SENSOR_DEVICE_ATTR_RO(power_cap_state, power_cap, 0);
+static SENSOR_DEVICE_ATTR_RO(power_cap_power, power_cap, 1);
+static SENSOR_DEVICE_ATTR_RO(power_cap_freq, power_cap, 2);
+
+static struct attribute *zenpower_powercap_attrs[] = {
+	&sensor_dev_attr_power_cap_state.dev_attr.attr,
+	&sensor_dev_attr_power_cap_power.dev_attr.attr,
+	&sensor_dev_attr_power_cap_freq.dev_attr.attr,
+	NULL
+};
+
+static umode_t zenpower_powercap_is_visible(struct kobject *kobj,
+					    struct attribute *attr, int index)
+{
+	struct zenpower_data *data = dev_get_drvdata(kobj_to_dev(kobj));
+
+	if (!data->pcap)
+		return 0;
+	/* Power and limit follow RAPL package power, which is root-only */
+	return index ? 0400 : attr->mode;
+}
+
+const struct attribute_group zenpower_powercap_group = {
+	.attrs = zenpower_powercap_attrs,
+	.is_visible = zenpower_powercap_is_visible,
+};
+
+/* Add a request for @policy if it is one of the package's. Caller holds pc->lock. */
+static void zenpower_pcap_add_policy(struct zenpower_pcap *pc,
+				     struct cpufreq_policy *policy)
+{
+	unsigned int cpu = cpumask_first(policy->related_cpus);
+	bool idle = pc->freq == pc->freq_max;
+	int err;
+
+	if (pc->closing || topology_physical_package_id(cpu) != pc->package ||
+	    freq_qos_request_active(&pc->req[cpu]))
+		return;
+
+	err = freq_qos_add_request(&policy->constraints, &pc->req[cpu], FREQ_QOS_MAX,
+				   idle ? policy->cpuinfo.max_freq : pc->applied);
+	if (err < 0)
+		return;
+
+	pc->nr_policies++;
+	pc->freq_min = min(pc->freq_min, policy->cpuinfo.min_freq);
+	pc->freq_max = max(pc->freq_max, policy->cpuinfo.max_freq);
+
+	/* Not limiting: follow the widened range */
+	if (idle)
+		pc->freq = pc->applied = pc->freq_max;
+}
+
+/* Drop the request of @policy, which is going away. Caller holds pc->lock. */
+static void zenpower_pcap_remove_policy(struct zenpower_pcap *pc,
+					struct cpufreq_policy *policy)
+{
+	struct freq_qos_request *req = &pc->req[cpumask_first(policy->related_cpus)];
+
+	if (!freq_qos_request_active(req) || req->qos != &policy->constraints)
+		return;
+
+	freq_qos_remove_request(req);
+	pc->nr_policies--;
+}
+
+static int zenpower_pcap_notifier(struct notifier_block *nb, unsigned long event,
+				  void *arg)
+{
+	struct zenpower_pcap *pc = container_of(nb, struct zenpower_pcap, nb);
+	struct cpufreq_policy *policy = arg;
+
+	mutex_lock(&pc->lock);
+	if (event == CPUFREQ_CREATE_POLICY)
+		zenpower_pcap_add_policy(pc, policy);
+	else if (event == CPUFREQ_REMOVE_POLICY)
+		zenpower_pcap_remove_policy(pc, policy);
+	mutex_unlock(&pc->lock);
+
+	return NOTIFY_OK;
+}
+
+/* Drop the QoS requests, which lifts the limit, then stop tracking policies */
+static void zenpower_powercap_release(void *arg)
+{
+	struct zenpower_pcap *pc = arg;
+	unsigned int cpu;
+
+	/* A policy being freed meanwhile finds its request already gone */
+	mutex_lock(&pc->lock);
+	pc->closing = true;
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		if (freq_qos_request_active(&pc->req[cpu]))
+			freq_qos_remove_request(&pc->req[cpu]);
+	}
+	pc->nr_policies = 0;
+	mutex_unlock(&pc->lock);
+
+	cpufreq_unregister_notifier(&pc->nb, CPUFREQ_POLICY_NOTIFIER);
+	kfree(pc);
+}
+
+/* Set up the controller. Called by the sampler before it starts. */
+int zenpower_powercap_init(struct zenpower_data *data, struct device *dev)
+{
+	struct cpufreq_policy *policy;
+	struct zenpower_pcap *pc;
+	int cpu, err;
+
+	if (!power_cap || !data->rapl_initialized)
+		return 0;
+	if (data->node_id % data->nodes_per_cpu)
+		return 0;
+
+	pc = kzalloc_node(struct_size(pc, req, nr_cpu_ids), GFP_KERNEL,
+			  data->numa_node);
+	if (!pc)
+		return -ENOMEM;
+	mutex_init(&pc->lock);
+	pc->package = data->cpu_id;
+	pc->freq_min = UINT_MAX;
+	pc->target = min_t(u64, (u64)power_cap_w * 1000000, ZEN_PCAP_MAX_UW);
+	pc->state = ZEN_PCAP_OFF;
+	pc->nb.notifier_call = zenpower_pcap_notifier;
+
+	/* Policies created from now on are seen by the notifier */
+	err = cpufreq_register_notifier(&pc->nb, CPUFREQ_POLICY_NOTIFIER);
+	if (err) {
+		kfree(pc);
+		return err;
+	}
+	err = devm_add_action_or_reset(dev, zenpower_powercap_release, pc);
+	if (err)
+		return err;
+
+	/* Existing ones are added here; the reference only covers the add */
+	cpus_read_lock();
+	for_each_online_cpu(cpu) {
+		if (topology_physical_package_id(cpu) != data->cpu_id)
+			continue;
+		policy = cpufreq_cpu_get(cpu);
+		if (!policy)
+			continue;
+		mutex_lock(&pc->lock);
+		zenpower_pcap_add_policy(pc, policy);
+		mutex_unlock(&pc->lock);
+		cpufreq_cpu_put(policy);
+	}
+	cpus_read_unlock();
+
+	data->pcap = pc;
+	mutex_lock(&pc->lock);
+	if (pc->nr_policies)
+		dev_info(dev, "Power cap controller on %d cpufreq policies, %u-%u MHz\n",
+			 pc->nr_policies, pc->freq_min / 1000, pc->freq_max / 1000);
+	else
+		dev_info(dev, "Power cap controller waiting for cpufreq policies\n");
+	mutex_unlock(&pc->lock);
+
+	return 0;
+}
@@ -3,115 +3,548 @@
  * zenpower - RAPL (Running Average Power Limit) backend
  *
  * RAPL provides power measurements via MSR energy counters.
- * Used by Zen 5.
+ * Probed on every family (Zen 1 onwards implement the AMD energy MSRs) and
+ * reported alongside SVI2 where both are available.
  *
- * Power is calculated from energy delta between reads divided by time delta.
+ * Power is calculated from the energy delta between reads divided by the
+ * time delta, with ns timestamps and 128-bit intermediates, so it stays exact
+ * for sub-millisecond windows. Energy is reported from 64-bit accumulators
+ * that extend the 32-bit hardware counters; the sampler keeps them updated
+ * between reads.
+ *
+ * The hardware updates the counters about once per millisecond. A power read
+ * that finds the counter unchanged returns the power of the last window
+ * instead of a false zero, and keeps the window open.
+ *
+ * The energy MSRs are per package, so every access runs on a CPU of the
+ * package owning the node: directly when the reader already is on one,
+ * otherwise through rdmsr_safe_on_cpu() on a cached CPU that a CPU hotplug
+ * callback keeps in the package.
+ *
+ * High-frequency mode (rapl_hf_us) samples the package counter from a pinned
+ * hrtimer. Each counter update is reported by the zenpower_rapl_hf
+ * tracepoint, RAPL_P_Package serves the power of the latest update interval
+ * without an MSR access, and rapl_hf_stats accounts for the cost of the
+ * timer callback itself. The cost of sub-millisecond periods has not been
+ * measured, so they are clamped to ZEN_RAPL_HF_MIN_US and warned about.
  */
 
 #include "zenpower.h"
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/smp.h>
+#include <linux/topology.h>
 #include <linux/version.h>
 #include <asm/msr.h>
 
+#include "zenpower_trace.h"
+
 /* Kernel 6.16+ renamed rdmsrl_safe to rdmsrq_safe */
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 16, 0)
 #define zenpower_rdmsrq_safe rdmsrq_safe
+#define zenpower_rdmsrq_safe_on_cpu rdmsrq_safe_on_cpu
 #else
 #define zenpower_rdmsrq_safe rdmsrl_safe
+#define zenpower_rdmsrq_safe_on_cpu rdmsrl_safe_on_cpu
 #endif
 
 /* AMD RAPL MSRs */
 #define MSR_AMD_RAPL_POWER_UNIT             0xc0010299
 #define MSR_AMD_PKG_ENERGY_STATUS           0xc001029b
-#define MSR_AMD_PP0_ENERGY_STATUS           0xc001029a
+#define MSR_AMD_CORE_ENERGY_STATUS          0xc001029a
 
 /* RAPL energy unit masks for MSR 0xc0010299 */
 #define RAPL_ENERGY_UNIT_MASK  0x1f00
 #define RAPL_ENERGY_UNIT_SHIFT 8
 
+/* 10^6 uJ/J * 10^9 ns/s: counts * this / ns, shifted by ESU, is uW */
+#define RAPL_UW_NS_SCALE       (USEC_PER_SEC * NSEC_PER_SEC)
+
+/* High-frequency sampling: shortest period accepted, and the measured one */
+#define ZEN_RAPL_HF_MIN_US     100
+#define ZEN_RAPL_HF_SAFE_US    1000
+
+static unsigned int rapl_hf_us;
+module_param(rapl_hf_us, uint, 0444);
+MODULE_PARM_DESC(rapl_hf_us, "RAPL high-frequency sampling period in us (0 = disabled, 1000 = 1 kHz; below 1000 is experimental, minimum 100)");
+
+/* Multi-instance CPU hotplug state tracking each node's RAPL CPU */
+static int rapl_cpuhp_state;
+
+/* High-frequency sampler state, touched from hardirq context */
+struct zenpower_rapl_hf {
+	struct hrtimer timer;
+	struct zenpower_data *data;
+	ktime_t period;
+	int cpu;
+	raw_spinlock_t lock;
+
+	u32 last;               /* last raw counter value */
+	u64 acc;                /* accumulated counts */
+	ktime_t last_update;    /* when the counter last changed */
+	u64 power;              /* uW over the last update interval */
+
+	/* Self-overhead accounting */
+	ktime_t start;
+	u64 ticks;
+	u64 updates;
+	u64 overruns;
+	u64 cost_ns;
+	u64 cost_max_ns;
+};
+
+/* Power in uW of @counts RAPL units over @ns nanoseconds, overflow-safe */
+static u64 rapl_power_uw(struct zenpower_data *data, u64 counts, u64 ns)
+{
+	return mul_u64_u64_div_u64(counts, RAPL_UW_NS_SCALE, ns) >> data->rapl_esu;
+}
+
+static bool rapl_cpu_in_package(struct zenpower_data *data, unsigned int cpu)
+{
+	return topology_physical_package_id(cpu) == data->cpu_id;
+}
+
+/* Online CPU of the owning package other than @exclude, preferring the node's NUMA node */
+static int rapl_pick_cpu(struct zenpower_data *data, int exclude)
+{
+	int cpu, found = -1;
+
+	for_each_online_cpu(cpu) {
+		if (cpu == exclude || !rapl_cpu_in_package(data, cpu))
+			continue;
+		if (cpu_to_node(cpu) == data->numa_node)
+			return cpu;
+		if (found < 0)
+			found = cpu;
+	}
+
+	return found;
+}
+
+/* Read a package MSR on a CPU of the owning package, without an IPI if already there */
+static int rapl_rdmsr(struct zenpower_data *data, u32 msr, u64 *val)
+{
+	int cpu, err;
+
+	cpu = get_cpu();
+	if (rapl_cpu_in_package(data, cpu)) {
+		err = zenpower_rdmsrq_safe(msr, val);
+		put_cpu();
+		return err;
+	}
+	put_cpu();
+
+	cpu = READ_ONCE(data->rapl_cpu);
+	if (cpu < 0)
+		return -ENODEV;
+
+	return zenpower_rdmsrq_safe_on_cpu(cpu, msr, val);
+}
+
+static int rapl_cpu_online(unsigned int cpu, struct hlist_node *node)
+{
+	struct zenpower_data *data = hlist_entry(node, struct zenpower_data, rapl_cpuhp);
+
+	if (data->rapl_cpu < 0 && rapl_cpu_in_package(data, cpu))
+		WRITE_ONCE(data->rapl_cpu, cpu);
+
+	return 0;
+}
+
+static int rapl_cpu_offline(unsigned int cpu, struct hlist_node *node)
+{
+	struct zenpower_data *data = hlist_entry(node, struct zenpower_data, rapl_cpuhp);
+
+	if (data->rapl_cpu == cpu)
+		WRITE_ONCE(data->rapl_cpu, rapl_pick_cpu(data, cpu));
+
+	return 0;
+}
+
+static void rapl_cpuhp_remove(void *arg)
+{
+	struct zenpower_data *data = arg;
+
+	cpuhp_state_remove_instance_nocalls(rapl_cpuhp_state, &data->rapl_cpuhp);
+}
+
+/* Cache the RAPL CPU and follow CPU hotplug, or pick it once without hotplug state */
+static int rapl_cpu_init(struct zenpower_data *data, struct device *dev)
+{
+	int err = 0;
+
+	/* Pick and register under the hotplug lock so no transition is missed */
+	cpus_read_lock();
+	data->rapl_cpu = rapl_pick_cpu(data, -1);
+	if (rapl_cpuhp_state > 0)
+		err = cpuhp_state_add_instance_nocalls_cpuslocked(rapl_cpuhp_state,
+								  &data->rapl_cpuhp);
+	cpus_read_unlock();
+
+	if (err || rapl_cpuhp_state <= 0)
+		return err;
+
+	return devm_add_action_or_reset(dev, rapl_cpuhp_remove, data);
+}
+
+int zenpower_rapl_cpuhp_init(void)
+{
+	int ret;
+
+	ret = cpuhp_setup_state_multi(CPUHP_AP_ONLINE_DYN, "hwmon/zenpower:rapl",
+				      rapl_cpu_online, rapl_cpu_offline);
+	if (ret < 0)
+		return ret;
+
+	rapl_cpuhp_state = ret;
+	return 0;
+}
+
+void zenpower_rapl_cpuhp_exit(void)
+{
+	if (rapl_cpuhp_state > 0)
+		cpuhp_remove_multi_state(rapl_cpuhp_state);
+}
+
 int zenpower_rapl_init(struct zenpower_data *data, struct device *dev)
 {
-	u64 val;
+	u64 val, energy;
 	u32 energy_unit;
 	int err;
 
+	err = rapl_cpu_init(data, dev);
+	if (err)
+		return err;
+
 	/* Read RAPL power unit MSR (0xc0010299) */
-	err = zenpower_rdmsrq_safe(MSR_AMD_RAPL_POWER_UNIT, &val);
+	err = rapl_rdmsr(data, MSR_AMD_RAPL_POWER_UNIT, &val);
 	if (err)
 		return err;
 
 	/* Extract energy unit: ESU = 1/(2^energy_unit) Joules */
 	energy_unit = (val & RAPL_ENERGY_UNIT_MASK) >> RAPL_ENERGY_UNIT_SHIFT;
 
-	/* Convert to microjoules per count: (1/(2^ESU)) * 1000000 */
-	data->rapl_energy_unit = 1000000 >> energy_unit;
+	data->rapl_esu = energy_unit;
 
-	/* Read initial package energy (channel 0) */
-	err = zenpower_rdmsrq_safe(MSR_AMD_PKG_ENERGY_STATUS, &data->rapl_prev_energy[0]);
+	/* Read initial package energy */
+	err = rapl_rdmsr(data, MSR_AMD_PKG_ENERGY_STATUS, &energy);
 	if (err)
 		return err;
 
-	data->rapl_available[0] = true;
+	/*
+	 * The core energy MSR counts for the core it is read on, so it is no
+	 * package channel; the Energy Model feed reads it on every core.
+	 */
+	data->rapl_core_energy = !rapl_rdmsr(data, MSR_AMD_CORE_ENERGY_STATUS, &val);
+	if (!data->rapl_core_energy)
+		dev_dbg(dev, "RAPL core energy MSR not available\n");
 
-	/* Read initial core energy (channel 1) */
-	err = zenpower_rdmsrq_safe(MSR_AMD_PP0_ENERGY_STATUS, &data->rapl_prev_energy[1]);
-	if (err) {
-		/* Core power MSR not available (expected on APUs) */
-		data->rapl_available[1] = false;
-		dev_dbg(dev, "RAPL Core power MSR not available\n");
-	} else {
-		data->rapl_available[1] = true;
-	}
+	data->rapl_prev_time = ktime_get();
+
+	/* Start the 64-bit accumulator from the current counter value */
+	mutex_init(&data->rapl_lock);
+	data->rapl_energy_last = (u32)energy;
 
-	/* Initialize timestamps for both channels */
-	data->rapl_prev_time[0] = ktime_get();
-	data->rapl_prev_time[1] = data->rapl_prev_time[0];
 	data->rapl_initialized = true;
 
 	return 0;
 }
 
-int zenpower_rapl_read_power(struct zenpower_data *data, int channel, long *val)
+/* Fold the current hardware counter into the accumulator. Caller holds rapl_lock. */
+static int rapl_accumulate(struct zenpower_data *data)
+{
+	u64 raw;
+	u32 now;
+	int err;
+
+	err = rapl_rdmsr(data, MSR_AMD_PKG_ENERGY_STATUS, &raw);
+	if (err)
+		return err;
+
+	/* 32-bit counter in a 64-bit register; u32 arithmetic handles the wrap */
+	now = (u32)raw;
+	data->rapl_energy_acc += (u32)(now - data->rapl_energy_last);
+	data->rapl_energy_last = now;
+
+	return 0;
+}
+
+/* Core energy counter and APERF/MPERF of the calling CPU, from an IPI */
+static void rapl_read_core(void *arg)
+{
+	struct zenpower_core_sample __percpu *out = (struct zenpower_core_sample __percpu __force *)arg;
+	struct zenpower_core_sample *s = this_cpu_ptr(out);
+
+	s->err = zenpower_rdmsrq_safe(MSR_AMD_CORE_ENERGY_STATUS, &s->energy);
+	if (!s->err)
+		s->err = zenpower_rdmsrq_safe(MSR_IA32_APERF, &s->aperf);
+	if (!s->err)
+		s->err = zenpower_rdmsrq_safe(MSR_IA32_MPERF, &s->mperf);
+}
+
+/*
+ * Read the per-core energy counter and APERF/MPERF on every online CPU of @mask, in one IPI round.
+ */
+void zenpower_rapl_read_cores(const struct cpumask *mask,
+			      struct zenpower_core_sample __percpu *out)
+{
+	on_each_cpu_mask(mask, rapl_read_core, (void __force *)out, true);
+}
+
+/* Power in uW of @counts RAPL energy units over @ns nanoseconds */
+u64 zenpower_rapl_counts_to_uw(struct zenpower_data *data, u64 counts, u64 ns)
+{
+	return rapl_power_uw(data, counts, ns);
+}
+
+/*
+ * Called by the sampler, often enough that no counter can wrap twice
+ * between two accumulations.
+ */
+void zenpower_rapl_sample(struct zenpower_data *data)
+{
+	mutex_lock(&data->rapl_lock);
+	rapl_accumulate(data);
+	mutex_unlock(&data->rapl_lock);
+}
+
+/* Accumulated package energy in microjoules */
+int zenpower_rapl_read_energy(struct zenpower_data *data, long *val)
+{
+	u64 acc;
+	int err;
+
+	if (!data->rapl_initialized)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&data->rapl_lock);
+	err = rapl_accumulate(data);
+	acc = data->rapl_energy_acc;
+	mutex_unlock(&data->rapl_lock);
+
+	if (err)
+		return err;
+
+	*val = mul_u64_u32_shr(acc, 1000000, data->rapl_esu);
+	return 0;
+}
+
+/* Accumulated energy in microjoules as of the last accumulation, no MSR access */
+u64 zenpower_rapl_get_energy(struct zenpower_data *data)
+{
+	u64 acc;
+
+	mutex_lock(&data->rapl_lock);
+	acc = data->rapl_energy_acc;
+	mutex_unlock(&data->rapl_lock);
+
+	return mul_u64_u32_shr(acc, 1000000, data->rapl_esu);
+}
+
+/* Package power in microwatts */
+int zenpower_rapl_read_power(struct zenpower_data *data, long *val)
 {
-	u64 energy_now, energy_delta;
-	ktime_t time_now, time_delta_ns;
-	u32 time_delta_ms;
+	struct zenpower_rapl_hf *hf = data->rapl_hf;
+	unsigned long flags;
+	ktime_t now;
+	u64 delta;
+	s64 dt;
 	int err;
-	u32 msr;
 
 	if (!data->rapl_initialized)
 		return -EAGAIN;
 
-	/* Select MSR based on channel: 0=package, 1=core */
-	msr = (channel == 0) ? MSR_AMD_PKG_ENERGY_STATUS :
-			       MSR_AMD_PP0_ENERGY_STATUS;
+	/* Package power straight from the high-frequency sampler */
+	if (hf) {
+		raw_spin_lock_irqsave(&hf->lock, flags);
+		*val = hf->power;
+		raw_spin_unlock_irqrestore(&hf->lock, flags);
+		return 0;
+	}
 
-	err = zenpower_rdmsrq_safe(msr, &energy_now);
+	mutex_lock(&data->rapl_lock);
+	err = rapl_accumulate(data);
 	if (err)
-		return err;
+		goto out;
 
-	time_now = ktime_get();
+	now = ktime_get();
+	delta = data->rapl_energy_acc - data->rapl_prev_acc;
+	dt = ktime_to_ns(ktime_sub(now, data->rapl_prev_time));
 
-	/* Handle 32-bit counter rollover */
-	if (energy_now >= data->rapl_prev_energy[channel]) {
-		energy_delta = energy_now - data->rapl_prev_energy[channel];
-	} else {
-		/* Counter wrapped (32-bit counter in 64-bit register) */
-		energy_delta = (0x100000000ULL - data->rapl_prev_energy[channel]) +
-			       energy_now;
+	/* Counter not updated yet: report the last window, keep this one open */
+	if (!delta || dt <= 0) {
+		*val = data->rapl_power;
+		goto out;
 	}
 
-	time_delta_ns = ktime_sub(time_now, data->rapl_prev_time[channel]);
-	time_delta_ms = ktime_to_ms(time_delta_ns);
+	data->rapl_power = rapl_power_uw(data, delta, dt);
+	data->rapl_prev_acc = data->rapl_energy_acc;
+	data->rapl_prev_time = now;
+	*val = data->rapl_power;
+out:
+	mutex_unlock(&data->rapl_lock);
+	return err;
+}
 
-	if (time_delta_ms == 0)
-		return -EAGAIN;
+/* hwmon handlers for RAPL_P_Package and RAPL_E_Package */
+int zenpower_rapl_hwmon_power(struct zenpower_data *data,
+			      const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	return zenpower_rapl_read_power(data, val);
+}
 
-	/* Power (microwatts) = energy (microjoules) / time (milliseconds) * 1000 */
-	*val = (energy_delta * data->rapl_energy_unit * 1000) / time_delta_ms;
+int zenpower_rapl_hwmon_energy(struct zenpower_data *data,
+			       const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	return zenpower_rapl_read_energy(data, val);
+}
 
-	/* Update state for next read */
-	data->rapl_prev_energy[channel] = energy_now;
-	data->rapl_prev_time[channel] = time_now;
+static enum hrtimer_restart rapl_hf_tick(struct hrtimer *timer)
+{
+	struct zenpower_rapl_hf *hf = container_of(timer, struct zenpower_rapl_hf, timer);
+	struct zenpower_data *data = hf->data;
+	ktime_t t0, t1;
+	u64 raw, overrun, interval = 0;
+	u32 now;
 
-	return 0;
+	t0 = ktime_get();
+
+	/* No IPI from hardirq context: skip ticks after hotplug moved the timer out of the package */
+	if (rapl_cpu_in_package(data, smp_processor_id()) &&
+	    !zenpower_rdmsrq_safe(MSR_AMD_PKG_ENERGY_STATUS, &raw)) {
+		now = (u32)raw;
+
+		raw_spin_lock(&hf->lock);
+		if (now != hf->last) {
+			hf->acc += (u32)(now - hf->last);
+			if (hf->last_update) {
+				interval = ktime_to_ns(ktime_sub(t0, hf->last_update));
+				hf->power = rapl_power_uw(data, (u32)(now - hf->last), interval);
+			}
+			hf->last = now;
+			hf->last_update = t0;
+			hf->updates++;
+		}
+		raw_spin_unlock(&hf->lock);
+
+		if (interval)
+			trace_zenpower_rapl_hf(data->node_id,
+					       mul_u64_u32_shr(hf->acc, 1000000, data->rapl_esu),
+					       hf->power, interval);
+	}
+
+	overrun = hrtimer_forward_now(timer, hf->period);
+	t1 = ktime_get();
+
+	raw_spin_lock(&hf->lock);
+	hf->ticks++;
+	if (overrun > 1)
+		hf->overruns += overrun - 1;
+	hf->cost_ns += ktime_to_ns(ktime_sub(t1, t0));
+	hf->cost_max_ns = max_t(u64, hf->cost_max_ns, ktime_to_ns(ktime_sub(t1, t0)));
+	raw_spin_unlock(&hf->lock);
+
+	return HRTIMER_RESTART;
+}
+
+/* Runs on the target CPU, so the pinned timer stays there */
+static void rapl_hf_start(void *arg)
+{
+	struct zenpower_rapl_hf *hf = arg;
+
+	hf->cpu = smp_processor_id();
+	hf->start = ktime_get();
+	hrtimer_start(&hf->timer, hf->period, HRTIMER_MODE_REL_PINNED);
+}
+
+static void rapl_hf_stop(void *arg)
+{
+	struct zenpower_rapl_hf *hf = arg;
+
+	hrtimer_cancel(&hf->timer);
+}
+
+/*
+ * Start the high-frequency sampler on @cpu (or locally for WORK_CPU_UNBOUND)
+ * when rapl_hf_us is set.
+ */
+int zenpower_rapl_hf_init(struct zenpower_data *data, struct device *dev, int cpu)
+{
+	struct zenpower_rapl_hf *hf;
+	unsigned int period_us;
+	u64 raw;
+	int err;
+
+	if (!rapl_hf_us || !data->rapl_initialized)
+		return 0;
+
+	period_us = max_t(unsigned int, rapl_hf_us, ZEN_RAPL_HF_MIN_US);
+	if (period_us < ZEN_RAPL_HF_SAFE_US)
+		dev_warn(dev, "rapl_hf_us=%u: sub-millisecond sampling overhead is unmeasured\n",
+			 period_us);
+
+	err = rapl_rdmsr(data, MSR_AMD_PKG_ENERGY_STATUS, &raw);
+	if (err)
+		return err;
+
+	hf = zenpower_devm_kzalloc(data, dev, sizeof(*hf));
+	if (!hf)
+		return -ENOMEM;
+
+	hf->data = data;
+	hf->period = ns_to_ktime((u64)period_us * NSEC_PER_USEC);
+	hf->last = (u32)raw;
+	raw_spin_lock_init(&hf->lock);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&hf->timer, rapl_hf_tick, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+#else
+	hrtimer_init(&hf->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+	hf->timer.function = rapl_hf_tick;
+#endif
+
+	if (cpu == WORK_CPU_UNBOUND || smp_call_function_single(cpu, rapl_hf_start, hf, 1))
+		rapl_hf_start(hf);
+
+	data->rapl_hf = hf;
+	dev_info(dev, "RAPL high-frequency sampling every %u us on CPU %d\n",
+		 period_us, hf->cpu);
+
+	return devm_add_action_or_reset(dev, rapl_hf_stop, hf);
+}
+
+ssize_t zenpower_rapl_hf_show(struct zenpower_data *data, char *buf)
+{
+	struct zenpower_rapl_hf *hf = data->rapl_hf;
+	u64 ticks, updates, overruns, cost, cost_max, elapsed;
+	unsigned long flags;
+
+	if (!hf)
+		return -ENODEV;
+
+	raw_spin_lock_irqsave(&hf->lock, flags);
+	ticks = hf->ticks;
+	updates = hf->updates;
+	overruns = hf->overruns;
+	cost = hf->cost_ns;
+	cost_max = hf->cost_max_ns;
+	raw_spin_unlock_irqrestore(&hf->lock, flags);
+
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), hf->start));
+
+	return sprintf(buf,
+		       "cpu: %d\n"
+		       "period_ns: %lld\n"
+		       "ticks: %llu\n"
+		       "updates: %llu\n"
+		       "overruns: %llu\n"
+		       "cost_avg_ns: %llu\n"
+		       "cost_max_ns: %llu\n"
+		       "overhead_ppm: %llu\n",
+		       hf->cpu, ktime_to_ns(hf->period), ticks, updates, overruns,
+		       ticks ? div64_u64(cost, ticks) : 0, cost_max,
+		       elapsed ? mul_u64_u64_div_u64(cost, USEC_PER_SEC, elapsed) : 0);
 }
@@ -0,0 +1,416 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - Background sampler
+ *
+ * Periodically samples the backends that benefit from it: the SMU PM table
+ * snapshot, so that hwmon readers are served from cached state, and the SVI2
+ * planes, whose power is integrated into energy counters.
+ *
+ * Each pass is summarised in a struct zenpower_sample (temperatures, plane
+ * and package power) that is handed to the consumers, such as the throttle
+ * detector, and kept as data->last_sample.
+ *
+ * When RAPL is available the sampler also runs without sample_interval_ms,
+ * at a slow housekeeping period, to extend the 32-bit RAPL energy counters
+ * before they can wrap (about 2 minutes at 500 W with a 15.3 uJ unit).
+ *
+ * One tick per package services every sampling node of that package in the
+ * same pass, so a multinode EPYC package wakes once per period instead of
+ * once per node. The tick runs on a CPU of the package's first node (see
+ * zenpower_sampler_cpu()), so its SMN and RAPL MSR reads stay local to the
+ * package.
+ *
+ * The tick is strict, on a normal timer with fixed deadlines, whenever a
+ * node has a consumer that depends on the cadence: SVI2 energy integration,
+ * the throttle detector, histograms, history or the power cap controller
+ * (see zenpower_sampler_strict()). Housekeeping-only sampling is strict as
+ * well. Otherwise, when the passes only refresh the snapshot and the PM
+ * table, the tick is deferrable: while its CPU is idle, the tick waits for
+ * the next wakeup instead of causing one, and the pass runs late. With RAPL
+ * present, a non-deferrable keepalive then still folds the RAPL counters
+ * every ZEN_RAPL_ACCUM_MS when no tick has run, so deferral can not miss a
+ * wrap. sample_strict=1 makes every tick strict.
+ */
+
+#include "zenpower.h"
+#include <linux/cpumask.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/topology.h>
+#include <linux/workqueue.h>
+
+static unsigned int sample_interval_ms;
+module_param(sample_interval_ms, uint, 0444);
+MODULE_PARM_DESC(sample_interval_ms, "Background sampling period in ms (0 = housekeeping only)");
+
+static bool sample_strict;
+module_param(sample_strict, bool, 0444);
+MODULE_PARM_DESC(sample_strict, "Keep the sampling cadence on idle CPUs even when nothing depends on it (default 0)");
+
+/* Housekeeping period for RAPL counter accumulation */
+#define ZEN_RAPL_ACCUM_MS	10000
+
+/* Tick of one package; kept until module exit once created */
+struct zenpower_tick {
+	struct list_head list;          /* on zenpower_ticks */
+	u8 package;
+	struct mutex lock;              /* held across a whole tick */
+	struct list_head nodes;         /* sampling nodes, by data->sample_node */
+	struct delayed_work work;       /* deferrable unless strict */
+	struct delayed_work keepalive;
+	unsigned int period_ms;
+	bool strict;                    /* the tick must not be deferred */
+	bool keepalive_on;              /* some node needs RAPL accumulation */
+	unsigned long next;
+	unsigned long last;
+};
+
+static DEFINE_MUTEX(zenpower_ticks_lock);
+static LIST_HEAD(zenpower_ticks);
+
+/* Online CPU on the node owning @data, or WORK_CPU_UNBOUND if none */
+int zenpower_sampler_cpu(struct zenpower_data *data)
+{
+	unsigned int cpu;
+
+	if (data->numa_node == NUMA_NO_NODE)
+		return WORK_CPU_UNBOUND;
+
+	cpu = cpumask_any_and(cpumask_of_node(data->numa_node), cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		return WORK_CPU_UNBOUND;
+
+	return cpu;
+}
+
+/* CPU running @tick's work: one of its first node. Caller holds tick->lock. */
+static int zenpower_tick_cpu(struct zenpower_tick *tick)
+{
+	return zenpower_sampler_cpu(list_first_entry(&tick->nodes, struct zenpower_data,
+						     sample_node));
+}
+
+/* Queue the next tick. Caller holds tick->lock. */
+static void zenpower_sampler_queue(struct zenpower_tick *tick)
+{
+	unsigned long period = msecs_to_jiffies(tick->period_ms);
+
+	if (list_empty(&tick->nodes))
+		return;
+
+	if (!tick->strict) {
+		queue_delayed_work_on(zenpower_tick_cpu(tick), system_wq, &tick->work, period);
+		return;
+	}
+
+	/* Fixed deadlines, so the pass run time does not add drift; missed ones are skipped */
+	tick->next += period;
+	if (time_before_eq(tick->next, jiffies))
+		tick->next = jiffies + period;
+	queue_delayed_work_on(zenpower_tick_cpu(tick), system_wq, &tick->work,
+			      tick->next - jiffies);
+}
+
+static void zenpower_sampler_temps(struct zenpower_data *data,
+				   struct zenpower_sample *s)
+{
+	int i;
+
+	/* Disabled channels are not read, see zenpower_chan_on() */
+	s->has_tctl = zenpower_chan_on(data, hwmon_temp, 0) ||
+		      zenpower_chan_on(data, hwmon_temp, 1);
+	if (s->has_tctl)
+		s->tctl = zenpower_temp_get_ctl(data);
+	s->tccd_max = 0;
+	for (i = 0; i < 8; i++) {
+		if (!data->ccd_visible[i] || !zenpower_chan_on(data, hwmon_temp, i + 2))
+			continue;
+		s->tccd[i] = zenpower_temp_get_ccd(data, data->ccd_addr[i]);
+		s->tccd_max = max(s->tccd_max, s->tccd[i]);
+		s->tccd_valid |= BIT(i);
+	}
+	s->has_temps = true;
+}
+
+static void zenpower_sampler_rapl(struct zenpower_data *data,
+				  struct zenpower_sample *s)
+{
+	const struct zenpower_sample *prev = &data->last_sample;
+	s64 dt;
+
+	zenpower_rapl_sample(data);
+	s->rapl_energy = zenpower_rapl_get_energy(data);
+
+	/* Package power over the pass, once there is a previous pass */
+	dt = ktime_to_ns(ktime_sub(s->time, prev->time));
+	if (prev->time && dt > 0 && s->rapl_energy >= prev->rapl_energy) {
+		/* uJ * 10^9 / ns = uW */
+		s->rapl_power = mul_u64_u64_div_u64(s->rapl_energy - prev->rapl_energy,
+						    NSEC_PER_SEC, dt);
+		s->has_rapl_power = true;
+	}
+}
+
+/* Whether a PM table channel is enabled; other readers refresh on demand */
+static bool zenpower_sampler_pmt_on(struct zenpower_data *data)
+{
+	return zenpower_chan_on(data, hwmon_curr, 2) ||
+	       zenpower_chan_on(data, hwmon_curr, 3) ||
+	       zenpower_chan_on(data, hwmon_power, 2);
+}
+
+static void zenpower_sampler_pass(struct zenpower_data *data)
+{
+	struct zenpower_sample s = { .time = ktime_get() };
+
+	if (data->pmt && data->sample_fast && zenpower_sampler_pmt_on(data))
+		zenpower_pmtable_sample(data);
+	if (data->svi2_energy)
+		zenpower_svi2_sample(data, &s);
+	if (data->rapl_initialized)
+		zenpower_sampler_rapl(data, &s);
+	if (data->sample_fast)
+		zenpower_sampler_temps(data, &s);
+
+	if (data->throttle_enabled)
+		zenpower_throttle_sample(data, &s);
+
+	spin_lock(&data->sample_lock);
+	zenpower_windows_sample(data, &s);
+	if (data->hist)
+		zenpower_hist_sample(data, &s);
+	if (data->history)
+		zenpower_history_sample(data, &s);
+	data->last_sample = s;
+	data->samples++;
+	spin_unlock(&data->sample_lock);
+
+	if (data->ccd_map && s.has_temps)
+		zenpower_ccd_sample(data, &s);
+	if (data->em)
+		zenpower_em_sample(data);
+	if (data->pcap)
+		zenpower_powercap_sample(data, &s);
+}
+
+/* One pass over every sampling node of the package */
+static void zenpower_sampler_tick(struct work_struct *work)
+{
+	struct zenpower_tick *tick = container_of(to_delayed_work(work),
+						  struct zenpower_tick, work);
+	struct zenpower_data *data;
+
+	mutex_lock(&tick->lock);
+	list_for_each_entry(data, &tick->nodes, sample_node)
+		zenpower_sampler_pass(data);
+	tick->last = jiffies;
+	zenpower_sampler_queue(tick);
+	mutex_unlock(&tick->lock);
+}
+
+/* Fold the RAPL counters when the deferrable tick has not run for a while */
+static void zenpower_sampler_keepalive(struct work_struct *work)
+{
+	struct zenpower_tick *tick = container_of(to_delayed_work(work),
+						  struct zenpower_tick, keepalive);
+	unsigned long limit = msecs_to_jiffies(ZEN_RAPL_ACCUM_MS);
+	struct zenpower_data *data;
+
+	mutex_lock(&tick->lock);
+	if (time_after(jiffies, tick->last + limit)) {
+		list_for_each_entry(data, &tick->nodes, sample_node) {
+			if (data->rapl_initialized)
+				zenpower_rapl_sample(data);
+		}
+	}
+	if (tick->keepalive_on && !list_empty(&tick->nodes))
+		queue_delayed_work_on(zenpower_tick_cpu(tick), system_wq, &tick->keepalive,
+				      limit);
+	mutex_unlock(&tick->lock);
+}
+
+/* Wait for a tick that may still be sampling @data */
+void zenpower_sampler_sync(struct zenpower_data *data)
+{
+	if (!data->tick)
+		return;
+
+	mutex_lock(&data->tick->lock);
+	mutex_unlock(&data->tick->lock);
+}
+
+/* Leave the tick; the tick stops by itself once no node is left */
+static void zenpower_sampler_stop(void *arg)
+{
+	struct zenpower_data *data = arg;
+
+	mutex_lock(&data->tick->lock);
+	list_del(&data->sample_node);
+	mutex_unlock(&data->tick->lock);
+}
+
+/* Whether @data has a consumer that a late pass would skew */
+static bool zenpower_sampler_strict(struct zenpower_data *data)
+{
+	return sample_strict || !data->sample_fast || data->svi2_energy ||
+	       data->throttle_enabled || data->hist || data->history || data->pcap;
+}
+
+/* Move a deferrable @tick to a normal timer. Caller holds zenpower_ticks_lock. */
+static void zenpower_tick_make_strict(struct zenpower_tick *tick)
+{
+	/* The work takes tick->lock, so it is cancelled before taking it */
+	cancel_delayed_work_sync(&tick->work);
+
+	mutex_lock(&tick->lock);
+	tick->strict = true;
+	INIT_DELAYED_WORK(&tick->work, zenpower_sampler_tick);
+	tick->next = jiffies;
+	zenpower_sampler_queue(tick);
+	mutex_unlock(&tick->lock);
+}
+
+/*
+ * Tick of @data's package, created for its first node. A node that needs
+ * a strict tick makes the package's tick strict; it then stays strict.
+ */
+static struct zenpower_tick *zenpower_tick_get(struct zenpower_data *data)
+{
+	bool strict = zenpower_sampler_strict(data);
+	struct zenpower_tick *tick;
+
+	mutex_lock(&zenpower_ticks_lock);
+	list_for_each_entry(tick, &zenpower_ticks, list) {
+		if (tick->package != data->cpu_id)
+			continue;
+		if (strict && !tick->strict)
+			zenpower_tick_make_strict(tick);
+		goto out;
+	}
+
+	tick = kzalloc(sizeof(*tick), GFP_KERNEL);
+	if (!tick)
+		goto out;
+	tick->package = data->cpu_id;
+	mutex_init(&tick->lock);
+	INIT_LIST_HEAD(&tick->nodes);
+	tick->strict = strict;
+	if (tick->strict)
+		INIT_DELAYED_WORK(&tick->work, zenpower_sampler_tick);
+	else
+		INIT_DEFERRABLE_WORK(&tick->work, zenpower_sampler_tick);
+	INIT_DELAYED_WORK(&tick->keepalive, zenpower_sampler_keepalive);
+	list_add_tail(&tick->list, &zenpower_ticks);
+out:
+	mutex_unlock(&zenpower_ticks_lock);
+	return tick;
+}
+
+/* Join the package's tick, starting it for the first node */
+static int zenpower_sampler_start(struct zenpower_data *data)
+{
+	struct zenpower_tick *tick = zenpower_tick_get(data);
+
+	if (!tick)
+		return -ENOMEM;
+
+	mutex_lock(&tick->lock);
+	data->tick = tick;
+	if (list_empty(&tick->nodes)) {
+		tick->period_ms = data->sample_interval_ms;
+		tick->keepalive_on = false;
+		tick->next = jiffies;
+		tick->last = jiffies;
+		list_add_tail(&data->sample_node, &tick->nodes);
+		zenpower_sampler_queue(tick);
+	} else {
+		/* Nodes only differ in RAPL support, which shortens the period */
+		tick->period_ms = min(tick->period_ms, data->sample_interval_ms);
+		list_add_tail(&data->sample_node, &tick->nodes);
+	}
+	if (data->rapl_initialized && !tick->strict && !tick->keepalive_on) {
+		tick->keepalive_on = true;
+		queue_delayed_work_on(zenpower_tick_cpu(tick), system_wq, &tick->keepalive,
+				      msecs_to_jiffies(ZEN_RAPL_ACCUM_MS));
+	}
+	mutex_unlock(&tick->lock);
+
+	return 0;
+}
+
+/* Called at module exit, after every node has left */
+void zenpower_sampler_exit(void)
+{
+	struct zenpower_tick *tick, *tmp;
+
+	list_for_each_entry_safe(tick, tmp, &zenpower_ticks, list) {
+		cancel_delayed_work_sync(&tick->work);
+		cancel_delayed_work_sync(&tick->keepalive);
+		list_del(&tick->list);
+		kfree(tick);
+	}
+}
+
+/*
+ * Start the sampler if anything needs it. Must run before the hwmon device
+ * is registered, as channel visibility depends on what is being sampled.
+ */
+int zenpower_sampler_init(struct zenpower_data *data, struct device *dev)
+{
+	unsigned int period = sample_interval_ms;
+	int err;
+
+	spin_lock_init(&data->sample_lock);
+	INIT_LIST_HEAD(&data->windows);
+	data->sample_fast = period;
+
+	/* SVI2 energy (planes are only set on backends that read them) */
+	data->svi2_energy = period && (data->svi_core_addr || data->svi_soc_addr);
+
+	/* RAPL counters must be accumulated before they wrap */
+	if (data->rapl_initialized && (!period || period > ZEN_RAPL_ACCUM_MS))
+		period = ZEN_RAPL_ACCUM_MS;
+
+	/* Sub-millisecond RAPL sampling runs from its own hrtimer */
+	err = zenpower_rapl_hf_init(data, dev, zenpower_sampler_cpu(data));
+	if (err)
+		dev_info(dev, "RAPL high-frequency sampling unavailable (%d)\n", err);
+
+	/* Temperatures are sampled on every fast pass, for the detector and histograms */
+	if (data->sample_fast) {
+		zenpower_throttle_init(data);
+		err = zenpower_hist_init(data, dev);
+		if (err)
+			dev_info(dev, "Histograms unavailable (%d)\n", err);
+		err = zenpower_ccd_init(data, dev);
+		if (err)
+			dev_info(dev, "CCD map unavailable (%d)\n", err);
+		err = zenpower_history_init(data, dev);
+		if (err)
+			dev_info(dev, "History unavailable (%d)\n", err);
+		err = zenpower_em_init(data, dev);
+		if (err)
+			dev_info(dev, "Energy Model feed unavailable (%d)\n", err);
+		err = zenpower_powercap_init(data, dev);
+		if (err)
+			dev_info(dev, "Power cap controller unavailable (%d)\n", err);
+	}
+
+	/* Nothing to sample in the background */
+	if (!period)
+		return 0;
+
+	data->sample_interval_ms = period;
+	err = zenpower_sampler_start(data);
+	if (err)
+		return err;
+
+	dev_info(dev, "Sampling every %u ms (%s tick of package %u)\n",
+		 data->sample_interval_ms, data->tick->strict ? "strict" : "deferrable",
+		 data->cpu_id);
+
+	return devm_add_action_or_reset(dev, zenpower_sampler_stop, data);
+}
@@ -7,9 +7,15 @@
  *
  * Voltage formula from LibreHardwareMonitor.
  * Current formulas discovered experimentally.
+ *
+ * SVI2 only provides instantaneous readings, so when the background sampler
+ * is running the V*I product of each plane is also integrated into 64-bit
+ * energy counters.
  */
 
 #include "zenpower.h"
+#include <linux/math64.h>
+#include <linux/spinlock.h>
 
 /*
  * Convert SVI2 plane value to voltage in millivolts
@@ -32,35 +38,143 @@ u32 zenpower_svi2_plane_to_vcc(u32 plane)
 }
 
 /*
- * Get core current from SVI2 plane value
+ * Get plane current from SVI2 plane value, with the backend's formula
  * Returns current in milliamps
  *
- * Zen1: I = 1039.211 * IDD_COR
- * Zen2+: I = 658.823 * IDD_COR
+ * Zen1: I = 1039.211 * IDD_COR (core), 360.772 * IDD_COR (SoC)
+ * Zen2+: I = 658.823 * IDD_COR (core), 294.3 * IDD_COR (SoC)
  */
-u32 zenpower_svi2_get_core_current(u32 plane, bool zen2)
+u32 zenpower_svi2_get_current(const struct zenpower_data *data, u32 plane, int i)
 {
-	u32 idd_cor, fc;
+	u32 idd_cor = plane & 0xff;
 
-	idd_cor = plane & 0xff;
-	fc = zen2 ? 658823 : 1039211;
+	return (data->backend->svi2_current[i] * idd_cor) / 1000;
+}
 
-	return (fc * idd_cor) / 1000;
+/*
+ * Get plane power from SVI2 plane value - [0]=core, [1]=SoC
+ * Returns power in microwatts (mA * mV)
+ */
+u32 zenpower_svi2_get_power(const struct zenpower_data *data, u32 plane, int i)
+{
+	return zenpower_svi2_get_current(data, plane, i) *
+	       zenpower_svi2_plane_to_vcc(plane);
 }
 
 /*
- * Get SoC current from SVI2 plane value
- * Returns current in milliamps
- *
- * Zen1: I = 360.772 * IDD_COR
- * Zen2+: I = 294.3 * IDD_COR
+ * Sample both planes and integrate power into the energy counters
+ * (trapezoidal rule between consecutive samples). Called by the sampler;
+ * the raw planes and their instantaneous power are stored in @s. A plane
+ * that is not read restarts its integration, so the time it was disabled
+ * adds no energy.
  */
-u32 zenpower_svi2_get_soc_current(u32 plane, bool zen2)
+void zenpower_svi2_sample(struct zenpower_data *data, struct zenpower_sample *s)
+{
+	u32 addr[2] = { data->svi_core_addr, data->svi_soc_addr };
+	u32 *power = s->svi2_power;
+	ktime_t now = s->time;
+	s64 dt;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		power[i] = 0;
+		if (!addr[i] || !zenpower_plane_on(data, i))
+			continue;
+		data->read_amdsmn_addr(data->pdev, data->node_id, addr[i],
+				       &s->svi2_plane[i]);
+		power[i] = zenpower_svi2_get_power(data, s->svi2_plane[i], i);
+		s->svi2_valid |= BIT(i);
+	}
+	s->has_svi2 = true;
+
+	spin_lock(&data->sample_lock);
+	for (i = 0; i < 2; i++) {
+		if (!(s->svi2_valid & BIT(i))) {
+			data->svi2_prev_time[i] = 0;
+			continue;
+		}
+
+		dt = ktime_to_ns(ktime_sub(now, data->svi2_prev_time[i]));
+		if (data->svi2_prev_time[i] && dt > 0) {
+			u32 avg = power[i] / 2 + data->svi2_prev_power[i] / 2;
+
+			/* uW * ns = fJ, / 10^6 = nJ */
+			data->svi2_energy_nj[i] += mul_u64_u32_div(dt, avg, 1000000);
+		}
+		data->svi2_prev_power[i] = power[i];
+		data->svi2_prev_time[i] = now;
+	}
+	spin_unlock(&data->sample_lock);
+}
+
+/* Integrated plane energy in microjoules */
+u64 zenpower_svi2_get_energy(struct zenpower_data *data, int channel)
+{
+	u64 nj;
+
+	spin_lock(&data->sample_lock);
+	nj = data->svi2_energy_nj[channel];
+	spin_unlock(&data->sample_lock);
+
+	return div_u64(nj, 1000);
+}
+
+/* hwmon handlers; ch->addr is the plane register, ch->index the plane */
+static u32 zenpower_svi2_read_plane(struct zenpower_data *data,
+				    const struct zenpower_channel *ch)
+{
+	u32 plane;
+
+	data->read_amdsmn_addr(data->pdev, data->node_id, ch->addr, &plane);
+	return plane;
+}
+
+static int zenpower_svi2_hwmon_in(struct zenpower_data *data,
+				  const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	*val = zenpower_svi2_plane_to_vcc(zenpower_svi2_read_plane(data, ch));
+	return 0;
+}
+
+static int zenpower_svi2_hwmon_curr(struct zenpower_data *data,
+				    const struct zenpower_channel *ch, u32 attr, long *val)
 {
-	u32 idd_cor, fc;
+	*val = zenpower_svi2_get_current(data, zenpower_svi2_read_plane(data, ch),
+					 ch->index);
+	return 0;
+}
 
-	idd_cor = plane & 0xff;
-	fc = zen2 ? 294300 : 360772;
+static int zenpower_svi2_hwmon_power(struct zenpower_data *data,
+				     const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	*val = zenpower_svi2_get_power(data, zenpower_svi2_read_plane(data, ch),
+				       ch->index);
+	return 0;
+}
 
-	return (fc * idd_cor) / 1000;
+static int zenpower_svi2_hwmon_energy(struct zenpower_data *data,
+				      const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	*val = zenpower_svi2_get_energy(data, ch->index);
+	return 0;
 }
+
+const struct zenpower_backend_ops zenpower_svi2_zen1_ops = {
+	.name = "SVI2 (ZEN1 formula)",
+	.temp = zenpower_temp_hwmon_ccd,
+	.in = zenpower_svi2_hwmon_in,
+	.curr = zenpower_svi2_hwmon_curr,
+	.power = zenpower_svi2_hwmon_power,
+	.energy = zenpower_svi2_hwmon_energy,
+	.svi2_current = { 1039211, 360772 },
+};
+
+const struct zenpower_backend_ops zenpower_svi2_zen2_ops = {
+	.name = "SVI2 (ZEN2 formula)",
+	.temp = zenpower_temp_hwmon_ccd,
+	.in = zenpower_svi2_hwmon_in,
+	.curr = zenpower_svi2_hwmon_curr,
+	.power = zenpower_svi2_hwmon_power,
+	.energy = zenpower_svi2_hwmon_energy,
+	.svi2_current = { 658823, 294300 },
+};
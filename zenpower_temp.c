@@ -39,3 +39,34 @@ unsigned int zenpower_temp_get_ccd(struct zenpower_data *data, u32 ccd_addr)
 
 	return (regval & ZEN_CCD_TEMP_MASK) * 125 - 49000;
 }
+
+/* hwmon handlers */
+int zenpower_temp_hwmon_tdie(struct zenpower_data *data,
+			     const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	if (attr == hwmon_temp_max) {
+		// source: https://www.amd.com/en/products/cpu/amd-ryzen-7-3700x
+		//         other cpus have also same* Tmax on AMD website
+		//         * = when taking into consideration a tctl offset
+		*val = ZEN_TCTL_MAX;
+		return 0;
+	}
+
+	*val = zenpower_temp_get_ctl(data) - data->temp_offset;
+	return 0;
+}
+
+int zenpower_temp_hwmon_tctl(struct zenpower_data *data,
+			     const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	*val = zenpower_temp_get_ctl(data);
+	return 0;
+}
+
+/* ch->addr is the CCD temperature register */
+int zenpower_temp_hwmon_ccd(struct zenpower_data *data,
+			    const struct zenpower_channel *ch, u32 attr, long *val)
+{
+	*val = zenpower_temp_get_ccd(data, ch->addr);
+	return 0;
+}
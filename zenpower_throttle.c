@@ -0,0 +1,258 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - Throttle detector
+ *
+ * Watches Tctl, the hottest CCD and package power on every sampler pass and
+ * tracks when each of them runs near its limit. Every source counts entries
+ * into and exits from its near-limit band and the total time spent there,
+ * so a slow job can be matched to throttling after the fact without polling
+ * at a high rate. Transitions are also reported by the zenpower_throttle
+ * tracepoint.
+ *
+ * Limits:
+ *  - Tctl/Tccd: the SMU thermal limit from the PM table when it is enabled,
+ *    ZEN_TCTL_MAX otherwise.
+ *  - Package power: the SMU PPT limit from the PM table, or the
+ *    throttle_power_limit parameter. Power is taken from the PM table, then
+ *    RAPL, then the SVI2 planes.
+ *
+ * A source enters its band at limit - margin and leaves it below
+ * limit - 2 * margin, so noise around the threshold is not counted as
+ * separate events. Requires sample_interval_ms; throttle=0 turns the
+ * detector off.
+ */
+
+#include "zenpower.h"
+#include <linux/hwmon-sysfs.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+
+#define CREATE_TRACE_POINTS
+#include "zenpower_trace.h"
+
+static bool throttle = true;
+module_param(throttle, bool, 0444);
+MODULE_PARM_DESC(throttle, "Track time near the thermal and power limits when the sampler runs (default 1)");
+
+static unsigned int throttle_temp_margin = 2000;
+module_param(throttle_temp_margin, uint, 0644);
+MODULE_PARM_DESC(throttle_temp_margin, "Throttle band below the temperature limit in millidegrees (default 2000)");
+
+static unsigned int throttle_power_margin = 3;
+module_param(throttle_power_margin, uint, 0644);
+MODULE_PARM_DESC(throttle_power_margin, "Throttle band below the power limit in percent (default 3)");
+
+static unsigned int throttle_power_limit;
+module_param(throttle_power_limit, uint, 0444);
+MODULE_PARM_DESC(throttle_power_limit, "Package power limit in W when the PM table has none (0 = no power detection)");
+
+/* Attribute indexes */
+enum {
+	ZEN_THROTTLE_ATTR_ENTRIES,
+	ZEN_THROTTLE_ATTR_EXITS,
+	ZEN_THROTTLE_ATTR_TIME,
+	ZEN_THROTTLE_ATTR_ACTIVE,
+	ZEN_THROTTLE_ATTR_LIMIT,
+};
+
+static long throttle_temp_limit(struct zenpower_data *data)
+{
+	long limit;
+
+	if (!zenpower_pmtable_read(data, ZEN_PMT_THM_LIMIT, &limit) && limit > 0)
+		return limit;
+
+	return ZEN_TCTL_MAX;
+}
+
+/* Package power and its limit in mW, false if either is unknown */
+static bool throttle_power(struct zenpower_data *data,
+			   const struct zenpower_sample *s,
+			   long *value, long *limit)
+{
+	if (zenpower_pmtable_read(data, ZEN_PMT_PPT_LIMIT, limit) || *limit <= 0)
+		*limit = (long)throttle_power_limit * 1000;
+	if (!*limit)
+		return false;
+
+	if (!zenpower_pmtable_read(data, ZEN_PMT_PPT_VALUE, value))
+		return true;
+
+	if (s->has_rapl_power) {
+		*value = div_u64(s->rapl_power, 1000);
+		return true;
+	}
+
+	if (data->svi2_energy) {
+		*value = (s->svi2_power[0] + s->svi2_power[1]) / 1000;
+		return true;
+	}
+
+	return false;
+}
+
+static void throttle_update(struct zenpower_data *data,
+			    enum zenpower_throttle_source src, ktime_t now,
+			    long value, long limit, long margin)
+{
+	struct zenpower_throttle_state *t = &data->throttle[src];
+	u64 duration = 0;
+	bool near;
+
+	/* Hysteresis: leave the band only well below where it was entered */
+	if (t->active)
+		near = value >= limit - 2 * margin;
+	else
+		near = value >= limit - margin;
+
+	spin_lock(&data->sample_lock);
+	t->limit = limit;
+	if (near == t->active) {
+		spin_unlock(&data->sample_lock);
+		return;
+	}
+
+	if (near) {
+		t->entries++;
+		t->since = now;
+	} else {
+		duration = ktime_to_ns(ktime_sub(now, t->since));
+		t->exits++;
+		t->time_ns += duration;
+	}
+	t->active = near;
+	spin_unlock(&data->sample_lock);
+
+	trace_zenpower_throttle(data->node_id, src, near, value, limit, duration);
+}
+
+void zenpower_throttle_sample(struct zenpower_data *data,
+			      const struct zenpower_sample *s)
+{
+	long value, limit, margin = throttle_temp_margin;
+
+	if (s->has_temps) {
+		limit = throttle_temp_limit(data);
+		if (s->has_tctl)
+			throttle_update(data, ZEN_THROTTLE_TCTL, s->time,
+					s->tctl, limit, margin);
+		if (s->tccd_max)
+			throttle_update(data, ZEN_THROTTLE_TCCD, s->time,
+					s->tccd_max, limit, margin);
+	}
+
+	if (data->throttle_power && throttle_power(data, s, &value, &limit)) {
+		margin = limit * throttle_power_margin / 100;
+		throttle_update(data, ZEN_THROTTLE_POWER, s->time,
+				value, limit, margin);
+	}
+}
+
+void zenpower_throttle_init(struct zenpower_data *data)
+{
+	int i;
+
+	if (!throttle)
+		return;
+
+	data->throttle_enabled = true;
+	data->throttle_power = throttle_power_limit ||
+			       zenpower_pmtable_has(data, ZEN_PMT_PPT_LIMIT);
+
+	for (i = 0; i < ZEN_THROTTLE_NR; i++)
+		data->throttle[i].limit = i == ZEN_THROTTLE_POWER ?
+					  (long)throttle_power_limit * 1000 :
+					  ZEN_TCTL_MAX;
+}
+
+static ssize_t throttle_show(struct device *dev,
+			     struct device_attribute *devattr, char *buf)
+{
+	struct sensor_device_attribute_2 *attr = to_sensor_dev_attr_2(devattr);
+	struct zenpower_data *data = dev_get_drvdata(dev);
+	struct zenpower_throttle_state *t = &data->throttle[attr->nr];
+	s64 val = 0;
+
+	spin_lock(&data->sample_lock);
+	switch (attr->index) {
+	case ZEN_THROTTLE_ATTR_ENTRIES:
+		val = t->entries;
+		break;
+	case ZEN_THROTTLE_ATTR_EXITS:
+		val = t->exits;
+		break;
+	case ZEN_THROTTLE_ATTR_TIME:
+		val = t->time_ns;
+		if (t->active)
+			val += ktime_to_ns(ktime_sub(ktime_get(), t->since));
+		val = div_u64(val, NSEC_PER_MSEC);
+		break;
+	case ZEN_THROTTLE_ATTR_ACTIVE:
+		val = t->active;
+		break;
+	case ZEN_THROTTLE_ATTR_LIMIT:
+		val = t->limit;
+		break;
+	}
+	spin_unlock(&data->sample_lock);
+
+	return sprintf(buf, "%lld\n", val);
+}
+
+#define ZEN_THROTTLE_ATTRS(_name, _src)							\
+	static SENSOR_DEVICE_ATTR_2_RO(throttle_##_name##_entries, throttle, _src,	\
+				       ZEN_THROTTLE_ATTR_ENTRIES);			\
+	static SENSOR_DEVICE_ATTR_2_RO(throttle_##_name##_exits, throttle, _src,	\
+				       ZEN_THROTTLE_ATTR_EXITS);			\
+	static SENSOR_DEVICE_ATTR_2_RO(throttle_##_name##_time_ms, throttle, _src,	\
+				       ZEN_THROTTLE_ATTR_TIME);				\
+	static SENSOR_DEVICE_ATTR_2_RO(throttle_##_name##_active, throttle, _src,	\
+				       ZEN_THROTTLE_ATTR_ACTIVE);			\
+	static SENSOR_DEVICE_ATTR_2_RO(throttle_##_name##_limit, throttle, _src,	\
+				       ZEN_THROTTLE_ATTR_LIMIT)
+
+ZEN_THROTTLE_ATTRS(tctl, ZEN_THROTTLE_TCTL);
+ZEN_THROTTLE_ATTRS(tccd, ZEN_THROTTLE_TCCD);
+ZEN_THROTTLE_ATTRS(power, ZEN_THROTTLE_POWER);
+
+#define ZEN_THROTTLE_ATTR_PTRS(_name)					\
+	&sensor_dev_attr_throttle_##_name##_entries.dev_attr.attr,	\
+	&sensor_dev_attr_throttle_##_name##_exits.dev_attr.attr,	\
+	&sensor_dev_attr_throttle_##_name##_time_ms.dev_attr.attr,	\
+	&sensor_dev_attr_throttle_##_name##_active.dev_attr.attr,	\
+	&sensor_dev_attr_throttle_##_name##_limit.dev_attr.attr
+
+static struct attribute *zenpower_throttle_attrs[] = {
+	ZEN_THROTTLE_ATTR_PTRS(tctl),
+	ZEN_THROTTLE_ATTR_PTRS(tccd),
+	ZEN_THROTTLE_ATTR_PTRS(power),
+	NULL
+};
+
+static umode_t zenpower_throttle_is_visible(struct kobject *kobj,
+					    struct attribute *attr, int index)
+{
+	struct device *dev = kobj_to_dev(kobj);
+	struct zenpower_data *data = dev_get_drvdata(dev);
+	struct sensor_device_attribute_2 *sattr =
+		container_of(attr, struct sensor_device_attribute_2, dev_attr.attr);
+
+	if (!data->throttle_enabled)
+		return 0;
+
+	switch (sattr->nr) {
+	case ZEN_THROTTLE_TCCD:
+		/* Any CCD sensor present */
+		return memchr_inv(data->ccd_visible, 0, sizeof(data->ccd_visible)) ?
+		       attr->mode : 0;
+	case ZEN_THROTTLE_POWER:
+		return data->throttle_power ? attr->mode : 0;
+	default:
+		return attr->mode;
+	}
+}
+
+const struct attribute_group zenpower_throttle_group = {
+	.attrs = zenpower_throttle_attrs,
+	.is_visible = zenpower_throttle_is_visible,
+};
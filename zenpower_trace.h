@@ -0,0 +1,97 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * zenpower - Tracepoints
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM zenpower
+
+#if !defined(ZENPOWER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define ZENPOWER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* Export the enum values, so user space can resolve __print_symbolic() */
+TRACE_DEFINE_ENUM(ZEN_THROTTLE_TCTL);
+TRACE_DEFINE_ENUM(ZEN_THROTTLE_TCCD);
+TRACE_DEFINE_ENUM(ZEN_THROTTLE_POWER);
+
+#define zenpower_throttle_source_names			\
+	{ ZEN_THROTTLE_TCTL,	"tctl" },		\
+	{ ZEN_THROTTLE_TCCD,	"tccd" },		\
+	{ ZEN_THROTTLE_POWER,	"power" }
+
+/*
+ * A throttle source crossed into (active) or out of its near-limit band.
+ * value and limit are millidegrees or milliwatts; duration_ns is the length
+ * of the near-limit period that just ended, 0 on entry.
+ */
+TRACE_EVENT(zenpower_throttle,
+
+	TP_PROTO(u16 node_id, u8 source, bool active, long value, long limit,
+		 u64 duration_ns),
+
+	TP_ARGS(node_id, source, active, value, limit, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(u16, node_id)
+		__field(u8, source)
+		__field(bool, active)
+		__field(long, value)
+		__field(long, limit)
+		__field(u64, duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->node_id = node_id;
+		__entry->source = source;
+		__entry->active = active;
+		__entry->value = value;
+		__entry->limit = limit;
+		__entry->duration_ns = duration_ns;
+	),
+
+	TP_printk("node=%u source=%s %s value=%ld limit=%ld duration_ns=%llu",
+		  __entry->node_id,
+		  __print_symbolic(__entry->source, zenpower_throttle_source_names),
+		  __entry->active ? "enter" : "exit",
+		  __entry->value, __entry->limit, __entry->duration_ns)
+);
+
+/*
+ * The package energy counter changed, seen by the RAPL high-frequency
+ * sampler. power_uw is the average over the interval_ns since the previous
+ * change; energy_uj is the sampler's running total.
+ */
+TRACE_EVENT(zenpower_rapl_hf,
+
+	TP_PROTO(u16 node_id, u64 energy_uj, u64 power_uw, u64 interval_ns),
+
+	TP_ARGS(node_id, energy_uj, power_uw, interval_ns),
+
+	TP_STRUCT__entry(
+		__field(u16, node_id)
+		__field(u64, energy_uj)
+		__field(u64, power_uw)
+		__field(u64, interval_ns)
+	),
+
+	TP_fast_assign(
+		__entry->node_id = node_id;
+		__entry->energy_uj = energy_uj;
+		__entry->power_uw = power_uw;
+		__entry->interval_ns = interval_ns;
+	),
+
+	TP_printk("node=%u energy_uj=%llu power_uw=%llu interval_ns=%llu",
+		  __entry->node_id, __entry->energy_uj, __entry->power_uw,
+		  __entry->interval_ns)
+);
+
+#endif /* ZENPOWER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE zenpower_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later WITH Linux-syscall-note */
+/*
+ * zenpower - Userspace interface of /dev/zenpower
+ *
+ * Energy measurement windows: a process opens a window on a node, runs its
+ * workload and closes the window to get the energy, average and peak power
+ * and temperature maxima of exactly that interval, timed by the kernel.
+ * Windows belong to the file descriptor that opened them; any number of
+ * them may overlap, on the same or on different nodes. Nodes are named by
+ * their dev_id, which stays the same while the module is loaded.
+ *
+ * Also describes the binary layout of the debugfs history file
+ * (zenpower/<node>/history).
+ */
+
+#ifndef ZENPOWER_UAPI_H
+#define ZENPOWER_UAPI_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define ZENPOWER_IOC_MAGIC          'z'
+
+/* Node capability flags */
+#define ZENPOWER_NODE_RAPL          (1U << 0)   /* RAPL package energy */
+#define ZENPOWER_NODE_SVI2          (1U << 1)   /* SVI2 energy (sampler) */
+#define ZENPOWER_NODE_SAMPLER       (1U << 2)   /* peak power and temperature maxima */
+
+struct zenpower_node_info {
+	__u32 index;            /* in: 0 .. number of nodes - 1 */
+	__u32 dev_id;           /* out: device to pass to WINDOW_OPEN */
+	__u32 node_id;          /* out: hardware node, 0 on kernels without SMN node ids */
+	__u32 flags;            /* out: ZENPOWER_NODE_* */
+	__u32 sample_interval_ms;   /* out: sampler period, 0 if not sampling */
+};
+
+struct zenpower_window_open {
+	__u32 dev_id;           /* in: from NODE_INFO */
+	__u32 id;               /* out: window id, unique per file descriptor */
+};
+
+/* Result validity flags */
+#define ZENPOWER_WINDOW_ENERGY      (1U << 0)   /* energy_uj, avg_power_uw */
+#define ZENPOWER_WINDOW_PEAK        (1U << 1)   /* peak_power_uw */
+#define ZENPOWER_WINDOW_TEMP        (1U << 2)   /* tctl_max */
+#define ZENPOWER_WINDOW_TCCD        (1U << 3)   /* tccd_max */
+#define ZENPOWER_WINDOW_SVI2        (1U << 4)   /* energy from SVI2, not RAPL */
+
+struct zenpower_window_result {
+	__u32 id;               /* in: window id */
+	__u32 flags;            /* out: ZENPOWER_WINDOW_* */
+	__u64 duration_ns;
+	__u64 energy_uj;
+	__u64 avg_power_uw;
+	__u64 peak_power_uw;    /* highest sampler-pass power */
+	__s32 tctl_max;         /* millidegrees */
+	__s32 tccd_max;         /* millidegrees, hottest CCD */
+	__u32 samples;          /* sampler passes inside the window */
+	__u32 node_id;
+};
+
+/* Describe node number info.index; -ENOENT past the last node */
+#define ZENPOWER_IOC_NODE_INFO      _IOWR(ZENPOWER_IOC_MAGIC, 0, struct zenpower_node_info)
+/* Open a window on a node */
+#define ZENPOWER_IOC_WINDOW_OPEN    _IOWR(ZENPOWER_IOC_MAGIC, 1, struct zenpower_window_open)
+/* Results so far, the window stays open */
+#define ZENPOWER_IOC_WINDOW_READ    _IOWR(ZENPOWER_IOC_MAGIC, 2, struct zenpower_window_result)
+/* Final results, the window is freed */
+#define ZENPOWER_IOC_WINDOW_CLOSE   _IOWR(ZENPOWER_IOC_MAGIC, 3, struct zenpower_window_result)
+
+/*
+ * History file: a struct zenpower_history_header, then for each tier its
+ * tiers[i].nr_valid buckets, oldest first. Temperatures are in
+ * millidegrees, power in mW.
+ */
+#define ZENPOWER_HISTORY_MAGIC      0x5a504859  /* "ZPHY" */
+#define ZENPOWER_HISTORY_VERSION    1
+#define ZENPOWER_HISTORY_TIERS      3
+
+enum zenpower_history_metric {
+	ZENPOWER_HISTORY_TCTL,
+	ZENPOWER_HISTORY_TCCD_MAX,  /* hottest CCD */
+	ZENPOWER_HISTORY_SVI2_CORE,
+	ZENPOWER_HISTORY_SVI2_SOC,
+	ZENPOWER_HISTORY_RAPL_PACKAGE,
+	ZENPOWER_HISTORY_METRICS
+};
+
+struct zenpower_history_tier {
+	__u32 period_s;         /* bucket length */
+	__u32 nr_buckets;       /* ring capacity */
+	__u32 nr_valid;         /* buckets that follow in the file */
+	__u32 reserved;
+};
+
+struct zenpower_history_header {
+	__u32 magic;
+	__u32 version;
+	__u32 nr_tiers;
+	__u32 nr_metrics;
+	__s64 realtime_offset_ns;   /* CLOCK_REALTIME - CLOCK_MONOTONIC when read */
+	struct zenpower_history_tier tiers[ZENPOWER_HISTORY_TIERS];
+};
+
+struct zenpower_history_stat {
+	__s32 min;
+	__s32 avg;
+	__s32 max;
+};
+
+struct zenpower_history_bucket {
+	__u64 start_ns;         /* CLOCK_MONOTONIC start, a multiple of the period */
+	__u32 samples;          /* sampler passes folded in */
+	__u32 valid;            /* bit per metric with data */
+	struct zenpower_history_stat stat[ZENPOWER_HISTORY_METRICS];
+	__u32 reserved;
+};
+
+#endif /* ZENPOWER_UAPI_H */
@@ -0,0 +1,76 @@
+#!/bin/bash
+#
+# Measure the overhead of RAPL high-frequency sampling at 1 kHz and 10 kHz.
+#
+# Reloads zenpower with rapl_hf_us set, lets it run, and reports the timer
+# callback cost from rapl_hf_stats together with the local timer interrupt
+# rate of the sampling CPU. Must run as root with zenpower built in this
+# directory or installed.
+#
+# Usage: ./zp_bench_rapl_hf.sh [seconds per rate] [period in us...]
+
+hwmon="/sys/class/hwmon"
+duration=${1:-10}
+shift
+periods=${@:-1000 100}
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "Must be run as root"
+    exit 1
+fi
+
+if [ -f zenpower.ko ]; then
+    load="insmod ./zenpower.ko"
+else
+    load="modprobe zenpower"
+fi
+
+find_zenpower() {
+    for dev in `ls $hwmon`; do
+        path="$hwmon/$dev"
+        if [ "`cat $path/name`" == "zenpower" ] && [ -f $path/rapl_hf_stats ]; then
+            echo $path
+            return
+        fi
+    done
+}
+
+loc_irqs() {
+    awk -v cpu=$1 '$1 == "LOC:" { print $(cpu + 2) }' /proc/interrupts
+}
+
+stat_value() {
+    awk -v key="$2:" '$1 == key { print $2 }' $1/rapl_hf_stats
+}
+
+printf "%-8s %-8s %10s %10s %10s %12s %12s %12s %10s\n" \
+    "rate" "cpu" "ticks" "updates" "overruns" "cost_avg_ns" "cost_max_ns" \
+    "overhead_ppm" "loc_irq/s"
+
+for us in $periods; do
+    rmmod zenpower 2>/dev/null
+    $load rapl_hf_us=$us || exit 1
+    sleep 1
+
+    path=`find_zenpower`
+    if [ -z "$path" ]; then
+        echo "RAPL high-frequency sampling not available"
+        rmmod zenpower
+        exit 1
+    fi
+
+    cpu=`stat_value $path cpu`
+    irq_start=`loc_irqs $cpu`
+    sleep $duration
+    irq_end=`loc_irqs $cpu`
+
+    printf "%-8s %-8s %10s %10s %10s %12s %12s %12s %10s\n" \
+        "$((1000000 / us))Hz" "$cpu" \
+        "`stat_value $path ticks`" "`stat_value $path updates`" \
+        "`stat_value $path overruns`" "`stat_value $path cost_avg_ns`" \
+        "`stat_value $path cost_max_ns`" "`stat_value $path overhead_ppm`" \
+        "$(((irq_end - irq_start) / duration))"
+done
+
+rmmod zenpower
+$load